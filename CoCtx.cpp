@@ -3,11 +3,18 @@
 namespace co::co_ctx
 {
     bool is_init{};
+    InitOptions options{};
+    NumaTopology numa{};
     std::shared_ptr<SchedManager> manager{};
     AllocatorGroup * g_alloc{};
     TSCNS clock{};
+    std::array<uint64_t, 40> time_slice_tsc{};
+#ifdef __SCHED_PREEMPT__
+    uint64_t preempt_tsc{};
+#endif
     std::shared_ptr<Timer> timer{};
     std::shared_ptr<Epoller> epoller{};
+    std::shared_ptr<BlockingPool> blocking_pool{};
 #ifdef __DEBUG_SCHED__
     std::unordered_set<Co_t*> co_vec{};
     std::unordered_multiset<Co_t*> running_co{};
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <cstddef>
 #include <cstdint>
@@ -7,12 +8,19 @@
 #include <thread>
 #include <cstring>
 #include <memory_resource>
+#include <pthread.h>
+#include <sched.h>
+#ifdef __SCHED_PREEMPT__
+#include <cpuid.h>
+#include <csignal>
+#endif
 
 #include "context/include/Context.h"
 #include "include/Coroutine.h"
 #include "include/CoPrivate.h"
 #include "include/CoCtx.h"
 #include "sched/include/Scheduler.h"
+#include "sched/include/BlockingPool.h"
 #include "allocator/include/MemoryPool.h"
 #include "io/include/epoller.h"
 #include "utils/include/co_utils.h"
@@ -24,7 +32,10 @@
 namespace co {
 	void wrap(void (*func)(void*), void * arg)
 	{
+		/* switched in for the first time */
+		preempt_reset();
 		func(arg);
+		preempt_disable();
 		co_ctx::loc->scheduler->jump_to_sched(CALL_DEAD);
 	}
 
@@ -51,15 +62,295 @@ namespace co {
 		};
 	}
 
+	void * alloc_invoker_batch(std::size_t size, std::size_t count, void ** out)
+	{
+		if (UNLIKELY(co_ctx::is_init == false))
+			throw co::CoInitializationException();
+
+		auto & pool = co_ctx::loc->alloc.invoker_pool;
+		std::lock_guard lock(pool.m_lock);
+		for (std::size_t i = 0; i < count; i++)
+		{
+			out[i] = pool.allocate_unsafe(size);
+			if (UNLIKELY(out[i] == nullptr))
+				throw CoCreateException();
+		}
+
+		return &pool;
+	}
+
+	static std::vector<int> get_affinity_cpus()
+	{
+		std::vector<int> ans{};
+		cpu_set_t cpu_set{};
+		CPU_ZERO(&cpu_set);
+		if (UNLIKELY(sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0))
+			throw CoInitializationException();
+
+		for (int i = 0; i < CPU_SETSIZE; i++)
+		{
+			if (CPU_ISSET(i, &cpu_set))
+				ans.push_back(i);
+		}
+
+		return ans;
+	}
+
+	static void init_options(const InitOptions & options)
+	{
+		auto & opt = co_ctx::options;
+		opt = options;
+		if (opt.cpu_list.empty())
+			opt.cpu_list = get_affinity_cpus();
+#ifdef __SINGLE_THREAD__
+		/* the only worker is the thread calling init */
+		if (UNLIKELY(opt.worker_count > 1))
+			throw CoInitializationException();
+		opt.worker_count = 1;
+#else
+		if (opt.worker_count == 0)
+			opt.worker_count = opt.cpu_list.size();
+#endif
+
+		if (UNLIKELY(opt.worker_count == 0 || opt.cpu_list.empty()))
+			throw CoInitializationException();
+
+		for (auto cpu : opt.cpu_list)
+		{
+			if (UNLIKELY(cpu < 0 || cpu >= CPU_SETSIZE))
+				throw CoInitializationException();
+		}
+
+		co_ctx::numa = opt.numa_aware ? NumaTopology::load(opt.numa_path) : NumaTopology{};
+		if (opt.time_slice_us == 0)
+			opt.time_slice_us = DEFAULT_TIME_SLICE_US;
+		if (opt.preempt_us == 0)
+			opt.preempt_us = DEFAULT_PREEMPT_US;
+		if (opt.blocking_threads == 0)
+			opt.blocking_threads = DEFAULT_BLOCKING_THREADS;
+		if (opt.blocking_idle_ms == 0)
+			opt.blocking_idle_ms = DEFAULT_BLOCKING_IDLE_MS;
+	}
+
+	/* slice of nice n: time_slice_us * weigh(n) / weigh(0), clamped to [MIN, 8 * time_slice_us] */
+	static void init_time_slice()
+	{
+		auto & opt = co_ctx::options;
+		auto tsc_per_us = co_ctx::clock.getTscGhz() * 1000;
+		for (int i = 0; i < 40; i++)
+		{
+			uint64_t slice_us = opt.time_slice_nice_us[i];
+			if (slice_us == 0)
+			{
+				slice_us = (uint64_t) opt.time_slice_us * nice_to_weigh[i] / nice_to_weigh[CfsSchedEntity::nice_offset];
+				slice_us = std::clamp<uint64_t>(slice_us, MIN_TIME_SLICE_US, (uint64_t) opt.time_slice_us * 8);
+			}
+			co_ctx::time_slice_tsc[i] = (uint64_t) (slice_us * tsc_per_us);
+		}
+#ifdef __SCHED_PREEMPT__
+		co_ctx::preempt_tsc = (uint64_t) (opt.preempt_us * tsc_per_us);
+#endif
+	}
+
+#ifdef __SCHED_PREEMPT__
+	/* SIGURG handler of async preemption, needs xsave to keep the extended state */
+	static void init_preempt()
+	{
+		unsigned eax{}, ebx{}, ecx{}, edx{};
+		if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE))
+			throw CoInitializationException();
+
+		/* ebx: xsave area size of the features enabled in xcr0 */
+		__get_cpuid_count(0xd, 0, &eax, &ebx, &ecx, &edx);
+		co_xsave_size = ebx;
+
+		struct sigaction act{};
+		act.sa_sigaction = &Scheduler::preempt_handler;
+		act.sa_flags = SA_SIGINFO | SA_RESTART;
+		sigemptyset(&act.sa_mask);
+		if (UNLIKELY(sigaction(SIGURG, &act, nullptr) != 0))
+			throw CoInitializationException();
+	}
+#endif
+
+	static int worker_cpu(int thread_idx)
+	{
+		auto & cpu_list = co_ctx::options.cpu_list;
+		return cpu_list[thread_idx % cpu_list.size()];
+	}
+
+	static int worker_numa_node(int thread_idx)
+	{
+		if (!co_ctx::options.numa_aware)
+			return 0;
+
+		return co_ctx::numa.node_of_cpu(worker_cpu(thread_idx));
+	}
+
+	static void pin_this_thread(int thread_idx)
+	{
+		auto & opt = co_ctx::options;
+		cpu_set_t cpu_set{};
+		CPU_ZERO(&cpu_set);
+		if (opt.pin_policy == PIN_CORE)
+		{
+			CPU_SET(worker_cpu(thread_idx), &cpu_set);
+			if (UNLIKELY(pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0))
+				throw CoInitializationException();
+		} else if (opt.numa_aware) {
+			/* pin to the cpus of its numa node, best effort */
+			int node = worker_numa_node(thread_idx);
+			for (auto cpu : opt.cpu_list)
+			{
+				if (co_ctx::numa.node_of_cpu(cpu) == node)
+					CPU_SET(cpu, &cpu_set);
+			}
+			pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+		}
+	}
+
+	uint16_t worker_count()
+	{
+		return co_ctx::options.worker_count;
+	}
+
+	/* nullptr without __SCHED_CFS_GROUP__, coroutines of it are in the root */
+	void * sched_group_create(int nice)
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		assert(cfs_nice_in_range(nice));
+#ifdef __SCHED_CFS_GROUP__
+		return new CfsGroup(nice, co_ctx::manager->schedulers.size());
+#else
+		return nullptr;
+#endif
+	}
+
+	void sched_group_release(void * group)
+	{
+#ifdef __SCHED_CFS_GROUP__
+		static_cast<CfsGroup *>(group)->release();
+#endif
+	}
+
+	/* sum of all schedulers, zero without __SCHED_EDF__ */
+	DeadlineStats deadline_stats()
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		DeadlineStats ans{};
+#ifdef __SCHED_EDF__
+		for (auto scheduler : co_ctx::manager->schedulers)
+		{
+			ans.finished += scheduler->deadline_finished.load(std::memory_order_relaxed);
+			ans.missed += scheduler->deadline_missed.load(std::memory_order_relaxed);
+			ans.stolen += scheduler->deadline_stolen.load(std::memory_order_relaxed);
+			ans.stolen_early += scheduler->deadline_stolen_early.load(std::memory_order_relaxed);
+		}
+#endif
+		return ans;
+	}
+
+	/* sum of all schedulers */
+	WakeBatchStats wake_batch_stats()
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		WakeBatchStats ans{};
+		for (auto scheduler : co_ctx::manager->schedulers)
+		{
+			ans.flushes += scheduler->batch_flushes.load(std::memory_order_relaxed);
+			ans.wakeups += scheduler->batch_wakeups.load(std::memory_order_relaxed);
+		}
+		return ans;
+	}
+
+	/* sum of all schedulers, zero without __SCHED_WAKE_AFFINE__ */
+	WakeAffineStats wake_affine_stats()
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		WakeAffineStats ans{};
+#ifdef __SCHED_WAKE_AFFINE__
+		for (auto scheduler : co_ctx::manager->schedulers)
+			ans.migrations += scheduler->wake_affine_pulls.load(std::memory_order_relaxed);
+#endif
+		return ans;
+	}
+
+	/* sum of all schedulers, zero without __STACK_DYN_RECLAIM__ */
+	StackReclaimStats stack_reclaim_stats()
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		StackReclaimStats ans{};
+#ifdef __STACK_DYN_RECLAIM__
+		for (auto scheduler : co_ctx::manager->schedulers)
+		{
+			ans.passes += scheduler->stk_pool->reclaim_passes.load(std::memory_order_relaxed);
+			ans.reclaimed_bytes += scheduler->stk_pool->reclaimed_bytes.load(std::memory_order_relaxed);
+		}
+#endif
+		return ans;
+	}
+
+	/* sum of all schedulers, zero without __STACK_DYN__ or with __MEM_PMR__ */
+	StackCacheStats stack_cache_stats()
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		StackCacheStats ans{};
+#if defined(__STACK_DYN__) && !defined(__MEM_PMR__)
+		for (auto scheduler : co_ctx::manager->schedulers)
+		{
+			ans.hot_hits += scheduler->stk_pool->hot_hits.load(std::memory_order_relaxed);
+			ans.remote_frees += scheduler->stk_pool->remote_frees.load(std::memory_order_relaxed);
+			ans.drained += scheduler->stk_pool->drained.load(std::memory_order_relaxed);
+		}
+#endif
+		return ans;
+	}
+
+	uint64_t reclaim_stacks([[maybe_unused]] std::chrono::milliseconds idle)
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		uint64_t ans{};
+#ifdef __STACK_DYN_RECLAIM__
+		auto idle_us = std::chrono::duration_cast<std::chrono::microseconds>(idle).count();
+		for (auto scheduler : co_ctx::manager->schedulers)
+			ans += scheduler->stk_pool->reclaim(idle_us);
+#endif
+		return ans;
+	}
+
 	void init_other(int thread_idx)
 	{
         /* sync data */
         std::atomic_thread_fence(std::memory_order_seq_cst);
+        /* set cpu affinity */
+        pin_this_thread(thread_idx);
 		/* init thread local */
 		co_ctx::loc = std::make_shared<local_t>();
         co_ctx::loc->thread_id = std::this_thread::get_id();
+#ifdef __STACK_DYN_GUARD__
+        DynStackPool::init_alt_stack();
+#endif
+        /* bind worker memory to its numa node, before scheduler stack allocate */
+        int numa_node = worker_numa_node(thread_idx);
+        if (co_ctx::options.numa_aware)
+            co_ctx::loc->alloc.bind_numa_node(numa_node);
         /* init system clock tick thread */
         co_ctx::loc->timer = std::make_shared<Timer>();
+#ifndef __SINGLE_THREAD__
         auto clock_tick_fn = [](const std::shared_ptr<local_t> & loc)
         {
             /* set local_t to main thread local_t */
@@ -72,6 +363,7 @@ namespace co {
             }
         };
         std::thread{clock_tick_fn, co_ctx::loc}.detach();
+#endif
 		/* init rand */
 		co_ctx::loc->rand = xor_shift_rand_64(std::chrono::steady_clock::now().time_since_epoch().count());
 		/* init scheduler and alloc memory */
@@ -92,6 +384,14 @@ namespace co {
         scheduler_ptr->sched_ctx = sched_ctx;
         co_ctx::loc->scheduler = scheduler_ptr;
         co_ctx::loc->scheduler->this_thread_id = thread_idx;
+        co_ctx::loc->scheduler->owner_id = std::this_thread::get_id();
+#ifdef __SCHED_PREEMPT__
+        co_ctx::loc->scheduler->owner_thread = pthread_self();
+#endif
+        co_ctx::loc->scheduler->numa_node = numa_node;
+#ifdef __STACK_DYN__
+        co_ctx::loc->scheduler->stk_pool = &co_ctx::loc->alloc.dyn_stk_pool;
+#endif
         co_ctx::manager->add_scheduler(co_ctx::loc->scheduler, thread_idx);
 		/* init scheduler context */
 		auto ctx = &co_ctx::loc->scheduler->sched_ctx;
@@ -107,11 +407,25 @@ namespace co {
 
 	void init()
 	{
+		init(InitOptions{});
+	}
+
+	void init(const InitOptions & options)
+	{
+		/* worker count and cpu list, all runtime sized pieces follow it */
+		init_options(options);
+#ifdef __SCHED_PREEMPT__
+		init_preempt();
+#endif
+#ifdef __STACK_DYN_GUARD__
+		DynStackPool::init_overflow_handler();
+#endif
         /* init global allocator */
         co_ctx::g_alloc = new AllocatorGroup();
 		/* currency is main thread */
 		/* init scheduler manager */
-		co_ctx::manager = std::make_shared<SchedManager>(CPU_CORE);
+		auto cpu_core = co_ctx::options.worker_count;
+		co_ctx::manager = std::make_shared<SchedManager>(cpu_core);
 		co_ctx::manager->init_lock.lock();
 		/* init thread local storage */
 		init_other(0);
@@ -119,7 +433,7 @@ namespace co {
         std::atomic_thread_fence(std::memory_order_seq_cst);
 
 		/* init other thread */
-		for (int i = 0; i < CPU_CORE - 1; i++)
+		for (int i = 0; i < cpu_core - 1; i++)
 			std::thread{init_other, i + 1}.detach();
 
 		/* wait until init finish */
@@ -136,12 +450,19 @@ namespace co {
             }
         };
         co_ctx::clock.init();
+        init_time_slice();
         std::thread{clock_calibrate_fn}.detach();
 
         /* init epoller thread */
         co_ctx::epoller = std::make_shared<Epoller>();
         std::thread{[]() { co_ctx::epoller->waiter(); }}.detach();
 
+        /* init blocking pool, threads are started on demand */
+        co_ctx::blocking_pool = std::make_shared<BlockingPool>(
+                co_ctx::options.blocking_threads,
+                std::chrono::milliseconds(co_ctx::options.blocking_idle_ms)
+        );
+
 		/* init finished */
 		co_ctx::is_init = true;
 
@@ -190,27 +511,97 @@ namespace co {
 		}
 	}
 
-    void * create(void (*func)(void *), void * arg, int nice)
+#ifdef __SCHED_CFS_GROUP__
+	/* the given group, or the group of the creator */
+	static CfsGroup * join_group(void * group)
+	{
+		auto ans = static_cast<CfsGroup *>(group);
+		if (ans == nullptr)
+		{
+			auto parent = Scheduler::current_co();
+			if (parent != nullptr)
+				ans = parent->sched.group;
+		}
+
+		if (ans != nullptr)
+			ans->acquire();
+		return ans;
+	}
+#endif
+
+    /* pool is the one mem came from, not reloaded from co_ctx::loc, the caller may have migrated since */
+    static Co_t * construct_co(void * mem, decltype(Co_t::allocator) pool, void (*func)(void *), void * arg, const CoAttr & attr)
+    {
+		auto co = new (mem) Co_t{}; // construct
+		co->allocator = pool;
+		co->sched.nice = attr.nice;
+#ifdef __SCHED_CFS_GROUP__
+		co->sched.group = join_group(attr.group);
+#endif
+#ifdef __SCHED_EDF__
+		co->sched.deadline_ns = attr.deadline_ns;
+#endif
+		co->ctx.stk_dyn_hint = static_cast<uint32_t>(std::min<std::size_t>(attr.stack_size, MAX_STACK_SIZE));
+        co->ctx.arg_reg.di = reinterpret_cast<uint64_t>(func);
+        co->ctx.arg_reg.si = reinterpret_cast<uint64_t>(arg);
+        return co;
+    }
+
+    void * create(void (*func)(void *), void * arg, const CoAttr & attr)
     {
 		if (UNLIKELY(!co_ctx::is_init))
 			return nullptr;
 
-		Co_t * co = static_cast<Co_t*>(co_ctx::loc->alloc.co_pool.allocate(sizeof(Co_t)));
-		if (UNLIKELY(co == nullptr))
-			return nullptr;
+		Co_t * co{};
+		{
+			/* the pool of this worker, freed to the same pool by destroy */
+			PreemptGuard guard{};
+			auto & pool = co_ctx::loc->alloc.co_pool;
+			void * mem = pool.allocate(sizeof(Co_t));
+			if (UNLIKELY(mem == nullptr))
+				return nullptr;
 
-		co = new (co) Co_t{}; // construct
-		co->allocator = &co_ctx::loc->alloc.co_pool;
-		co->sched.nice = nice;
-        co->ctx.arg_reg.di = reinterpret_cast<uint64_t>(func);
-        co->ctx.arg_reg.si = reinterpret_cast<uint64_t>(arg);
+			co = construct_co(mem, &pool, func, arg, attr);
+		}
 		co_ctx::manager->apply(co);
         return co;
     }
 
-	void * create(void * invoker_self, int nice)
+	void * create(void * invoker_self, const CoAttr & attr)
 	{
-		return create(&invoker_wrapper, invoker_self, nice);
+		return create(&invoker_wrapper, invoker_self, attr);
+	}
+
+	void create_batch(void * const * invokers, void ** handles, std::size_t count, const CoAttr & attr)
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		std::vector<Co_t*> co_vec{};
+		co_vec.reserve(count);
+		{
+			PreemptGuard guard{};
+			auto & pool = co_ctx::loc->alloc.co_pool;
+#ifndef __MEM_PMR__
+			/* one pool lock for the whole batch */
+			std::lock_guard lock(pool.m_lock);
+#endif
+			for (std::size_t i = 0; i < count; i++)
+			{
+#ifdef __MEM_PMR__
+				void * mem = pool.allocate(sizeof(Co_t));
+#else
+				void * mem = pool.allocate_unsafe(sizeof(Co_t));
+#endif
+				if (UNLIKELY(mem == nullptr))
+					throw CoCreateException();
+
+				co_vec.push_back(construct_co(mem, &pool, &invoker_wrapper, invokers[i], attr));
+				handles[i] = co_vec.back();
+			}
+		}
+
+		co_ctx::manager->apply_batch(co_vec);
 	}
 
 	void await_impl(void * handle)
@@ -228,18 +619,73 @@ namespace co {
 			return;
 		}
 
-        co_ctx::loc->scheduler->await_callee = callee;
-		co_ctx::loc->scheduler->jump_to_sched(CALL_AWAIT);
+		/* re-enabled when switched in */
+		preempt_disable();
+		auto scheduler = co_ctx::loc->scheduler;
+		scheduler->await_callee = callee;
+		scheduler->jump_to_sched(CALL_AWAIT);
+	}
+
+	void spawn_blocking_impl(InvokerBase * invoker)
+	{
+		if (UNLIKELY(!co_ctx::is_init))
+			throw CoInitializationException();
+
+		/* re-enabled when switched in */
+		preempt_disable();
+		auto scheduler = co_ctx::loc->scheduler;
+#ifdef __STACK_STATIC__
+		/* the pool thread writes the task while other coroutines run on the shared stack */
+		auto task_holder = std::make_unique<BlockingTask>();
+		auto & task = *task_holder;
+#else
+		BlockingTask task{};
+#endif
+		task.invoker = invoker;
+		task.co = scheduler->running_co;
+		scheduler->interrupt(CO_WAITING);
+		scheduler->remove_from_scheduler(task.co);
+		/* applied by the pool thread, runs after the switch out finished like Sem_t::wait */
+		co_ctx::blocking_pool->submit(std::addressof(task));
+		scheduler->jump_to_sched();
+
+		if (UNLIKELY(task.exception != nullptr))
+			std::rethrow_exception(task.exception);
 	}
 
     void yield()
 	{
+		/* thread local is read before the switch, re-enabled when switched in */
+		preempt_disable();
 		DASSERT(co_ctx::loc->scheduler->running_co != nullptr);
 		co_ctx::loc->scheduler->jump_to_sched(CALL_YIELD);
 	}
 
+	/* yield only if the time slice is used up and someone else is ready */
+	bool maybe_yield()
+	{
+		{
+			PreemptGuard guard{};
+			auto scheduler = co_ctx::loc->scheduler;
+			if (LIKELY(TSCNS::rdtsc() < scheduler->slice_deadline))
+				return false;
+
+			if (!scheduler->has_ready())
+			{
+				/* nobody to yield to, check again after a whole slice */
+				auto nice = scheduler->running_co->sched.nice;
+				scheduler->slice_deadline = TSCNS::rdtsc() + co_ctx::time_slice_tsc[nice + CfsSchedEntity::nice_offset];
+				return false;
+			}
+		}
+
+		yield();
+		return true;
+	}
+
     void sleep(std::chrono::microseconds duration)
     {
+        preempt_disable();
         auto loc = co_ctx::loc.get();
         loc->scheduler->sleep_args.sleep_duration = duration;
         loc->scheduler->jump_to_sched(CALL_SLEEP);
@@ -247,6 +693,7 @@ namespace co {
 
     void sleep_until(std::chrono::microseconds until)
     {
+        preempt_disable();
         auto loc = co_ctx::loc.get();
         loc->scheduler->sleep_args.sleep_until = until;
         loc->scheduler->jump_to_sched(CALL_SLEEP);
@@ -2,34 +2,437 @@
 // Created by hzj on 25-1-19.
 //
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <mutex>
+#include <unistd.h>
 
 #include "../context/include/Context.h"
 #include "DynStackPool.h"
+#include "../include/CoCtx.h"
+#ifdef __STACK_DYN_GUARD__
+#include "../include/CoPrivate.h"
+#include "../sched/include/Scheduler.h"
+#include "../utils/include/numa_utils.h"
+#elif defined(__STACK_DYN_RECLAIM__)
+#include "../include/CoPrivate.h"
+#endif
 
 namespace co {
+    std::size_t DynStackPool::pool_block_count()
+    {
+        return std::max<std::size_t>(co_ctx::options.worker_count * 8, MIN_POOL_BLOCK_COUNT);
+    }
+
+#ifdef __STACK_DYN_GUARD__
+    struct sigaction DynStackPool::prev_segv_act{};
+
+    /* message built in a signal handler, snprintf is not async signal safe */
+    struct signal_msg
+    {
+        char buf[256]{};
+        std::size_t len{};
+
+        void put(const char * s)
+        {
+            while (*s != '\0' && len < sizeof(buf))
+                buf[len++] = *s++;
+        }
+
+        void put_int(int64_t x)
+        {
+            if (x < 0)
+                put("-");
+
+            char tmp[20];
+            int n = 0;
+            auto u = x < 0 ? -static_cast<uint64_t>(x) : static_cast<uint64_t>(x);
+            do {
+                tmp[n++] = static_cast<char>('0' + u % 10);
+                u /= 10;
+            } while (u != 0);
+            while (n > 0 && len < sizeof(buf))
+                buf[len++] = tmp[--n];
+        }
+
+        void put_ptr(const void * p)
+        {
+            put("0x");
+            char tmp[16];
+            int n = 0;
+            auto u = reinterpret_cast<uint64_t>(p);
+            do {
+                tmp[n++] = "0123456789abcdef"[u & 15];
+                u >>= 4;
+            } while (u != 0);
+            while (n > 0 && len < sizeof(buf))
+                buf[len++] = tmp[--n];
+        }
+    };
+
+    DynStackPool::~DynStackPool()
+    {
+        for (auto node = remote_free.exchange(nullptr); node != nullptr;)
+        {
+            auto next = node->next;
+            delete_stk(node->stk_mem, STACK_CLASS_SIZE[node->cls]);
+            node = next;
+        }
+
+        for (std::size_t cls = 0; cls < STACK_CLASS_COUNT; cls++)
+        {
+            for (std::size_t i = 0; i < hot_stk_count[cls]; i++)
+                delete_stk(hot_stk[cls][i], STACK_CLASS_SIZE[cls]);
+            for (auto stk_mem : free_stk_list[cls])
+                delete_stk(stk_mem, STACK_CLASS_SIZE[cls]);
+        }
+    }
+
+    void DynStackPool::overflow_handler(int sig, siginfo_t * info, void * uc)
+    {
+        auto addr = reinterpret_cast<uint64_t>(info->si_addr);
+        auto in_guard = [addr](const Context & ctx)
+        {
+            auto stk_low = reinterpret_cast<uint64_t>(ctx.stk_dyn_mem);
+            return stk_low != 0 && addr >= stk_low - GUARD_SIZE && addr < stk_low;
+        };
+
+        auto loc = co_ctx::loc.get();
+        if (loc != nullptr && loc->scheduler != nullptr)
+        {
+            auto scheduler = loc->scheduler;
+            auto co = scheduler->running_co;
+            const Context * ctx{};
+            if (co != nullptr && in_guard(co->ctx))
+                ctx = &co->ctx;
+            else if (in_guard(scheduler->sched_ctx))
+                ctx = &scheduler->sched_ctx;
+
+            if (ctx != nullptr)
+            {
+                auto on_sched = ctx == &scheduler->sched_ctx;
+                signal_msg msg{};
+                msg.put("coroutine stack overflow: ");
+                msg.put(on_sched ? "scheduler " : "coroutine ");
+                msg.put_ptr(on_sched ? static_cast<void *>(scheduler) : static_cast<void *>(co));
+                msg.put(", worker ");
+                msg.put_int(scheduler->this_thread_id);
+                msg.put(", fault address ");
+                msg.put_ptr(info->si_addr);
+                msg.put(", stack [");
+                msg.put_ptr(ctx->stk_dyn_mem);
+                msg.put(", ");
+                msg.put_ptr(ctx->stk_dyn);
+                msg.put(")\n");
+                [[maybe_unused]] auto res = write(STDERR_FILENO, msg.buf, msg.len);
+
+                /* fault again on return, with the default action */
+                signal(sig, SIG_DFL);
+                return;
+            }
+        }
+
+        if (prev_segv_act.sa_flags & SA_SIGINFO)
+            prev_segv_act.sa_sigaction(sig, info, uc);
+        else if (prev_segv_act.sa_handler != SIG_DFL && prev_segv_act.sa_handler != SIG_IGN)
+            prev_segv_act.sa_handler(sig);
+        else
+            signal(sig, SIG_DFL);
+    }
+
+    void DynStackPool::init_overflow_handler()
+    {
+        struct sigaction act{};
+        act.sa_sigaction = &DynStackPool::overflow_handler;
+        act.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&act.sa_mask);
+        if (UNLIKELY(sigaction(SIGSEGV, &act, &prev_segv_act) != 0))
+            throw CoInitializationException();
+    }
+
+    void DynStackPool::init_alt_stack()
+    {
+        stack_t ss{};
+        ss.ss_size = std::max<std::size_t>(ALT_STACK_SIZE, SIGSTKSZ);
+        ss.ss_sp = std::malloc(ss.ss_size);
+        if (UNLIKELY(ss.ss_sp == nullptr || sigaltstack(&ss, nullptr) != 0))
+            throw CoInitializationException();
+    }
+#endif
+
+#ifdef __STACK_DYN_RECLAIM__
+    void DynStackPool::track(Co_t * co)
+    {
+        std::lock_guard lock(live_lock);
+        co->ctx.stk_dyn_live_idx = static_cast<int32_t>(live_co.size());
+        live_co.push_back(co);
+    }
+
+    /* swap with the last one */
+    void DynStackPool::untrack(Co_t * co)
+    {
+        std::lock_guard lock(live_lock);
+        auto idx = co->ctx.stk_dyn_live_idx;
+        if (idx < 0)
+            return;
+
+        live_co[idx] = live_co.back();
+        live_co[idx]->ctx.stk_dyn_live_idx = idx;
+        live_co.pop_back();
+        co->ctx.stk_dyn_live_idx = -1;
+    }
+
+    uint64_t DynStackPool::reclaim(int64_t idle_us)
+    {
+        uint64_t ans{};
+        auto now = co_ctx::clock.rdus();
+        std::lock_guard lock(live_lock);
+        for (auto co : live_co)
+        {
+            /* held from prepare_run to the switch out, the stack is not in use while we hold it */
+            if (!co->stk_active_lock.try_lock())
+                continue;
+
+            auto & ctx = co->ctx;
+            if (co->status == CO_WAITING && !ctx.stk_dyn_reclaimed && ctx.stk_dyn_park_us + idle_us <= now)
+            {
+                auto low = (reinterpret_cast<uint64_t>(ctx.stk_dyn_mem) + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+                auto high = (ctx.jmp_reg.sp - RED_ZONE) & ~(PAGE_SIZE - 1);
+                if (high > low)
+                {
+                    /* only resident pages count, from the lowest one dirtied up to sp */
+                    auto page_cnt = (high - low) / PAGE_SIZE;
+                    resident.resize(std::max(resident.size(), page_cnt));
+                    if (mincore(reinterpret_cast<void *>(low), high - low, resident.data()) == 0)
+                    {
+                        auto first = std::find_if(resident.begin(), resident.begin() + page_cnt, [](unsigned char v) { return v & 1; });
+                        auto resident_cnt = std::count_if(first, resident.begin() + page_cnt, [](unsigned char v) { return v & 1; });
+                        auto from = low + (first - resident.begin()) * PAGE_SIZE;
+                        if (resident_cnt > 0 && madvise(reinterpret_cast<void *>(from), high - from, MADV_DONTNEED) == 0)
+                            ans += resident_cnt * PAGE_SIZE;
+                    }
+                }
+
+                ctx.stk_dyn_reclaimed = true;
+            }
+            co->stk_active_lock.unlock();
+        }
+
+        reclaimed_bytes.fetch_add(ans, std::memory_order_relaxed);
+        return ans;
+    }
+
+    void DynStackPool::reclaim_tick()
+    {
+        /* the tick thread starts before the clock */
+        if (UNLIKELY(!co_ctx::is_init))
+            return;
+
+        auto now = co_ctx::clock.rdus();
+        if (now < next_reclaim_us)
+            return;
+
+        auto idle_us = static_cast<int64_t>(co_ctx::options.stack_reclaim_ms) * 1000;
+        if (idle_us == 0)
+            idle_us = static_cast<int64_t>(DEFAULT_STACK_RECLAIM_MS) * 1000;
+
+        /* the first tick only sets the deadline */
+        if (next_reclaim_us != 0)
+        {
+            reclaim(idle_us);
+            reclaim_passes.fetch_add(1, std::memory_order_relaxed);
+        }
+        next_reclaim_us = now + idle_us;
+    }
+#endif
+
+    void DynStackPool::bind_numa_node([[maybe_unused]] int node)
+    {
+#ifdef __STACK_DYN_GUARD__
+        numa_node = node;
+#elif !defined(__MEM_PMR__)
+        dyn_stk_pool.bind_numa_node(node);
+#endif
+    }
+
+    std::size_t DynStackPool::stack_class(std::size_t hint)
+    {
+        if (hint == 0)
+            return STACK_CLASS_COUNT - 1;
+
+        auto it = std::lower_bound(STACK_CLASS_SIZE.begin(), STACK_CLASS_SIZE.end(), hint);
+        if (it == STACK_CLASS_SIZE.end())
+            return STACK_CLASS_COUNT - 1;
+
+        return it - STACK_CLASS_SIZE.begin();
+    }
+
+#ifndef __MEM_PMR__
+    bool DynStackPool::is_owner() const
+    {
+        auto loc = co_ctx::loc.get();
+        return loc != nullptr && &loc->alloc.dyn_stk_pool == this;
+    }
+
+    void * DynStackPool::pop_hot_stk(std::size_t cls)
+    {
+        if (hot_stk_count[cls] == 0)
+            return nullptr;
+
+        hot_hits.fetch_add(1, std::memory_order_relaxed);
+        return hot_stk[cls][--hot_stk_count[cls]];
+    }
+
+    /* full: the coldest one moves to free_stk_list */
+    void DynStackPool::push_hot_stk(std::size_t cls, void * stk_mem)
+    {
+        auto & hot = hot_stk[cls];
+        auto & count = hot_stk_count[cls];
+        if (count == HOT_STK_COUNT)
+        {
+            if (!push_free_stk(cls, hot[0]))
+                delete_stk(hot[0], STACK_CLASS_SIZE[cls]);
+            std::move(hot.begin() + 1, hot.end(), hot.begin());
+            count--;
+        }
+
+        hot[count++] = stk_mem;
+    }
+
+    void DynStackPool::push_remote_free(std::size_t cls, void * stk_mem)
+    {
+        /* the reserve above the stack is never touched by frames */
+        auto node = reinterpret_cast<remote_stk_t *>(static_cast<uint8_t *>(stk_mem) + STACK_CLASS_SIZE[cls]);
+        node->stk_mem = stk_mem;
+        node->cls = cls;
+        node->next = remote_free.load(std::memory_order_relaxed);
+        while (!remote_free.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed));
+        remote_frees.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* cache-cold, behind the hot stacks, under one lock */
+    void DynStackPool::drain_remote_free()
+    {
+        auto node = remote_free.exchange(nullptr, std::memory_order_acquire);
+        remote_stk_t * overflow{};
+        uint64_t cnt{};
+        {
+            std::lock_guard lock(m_lock);
+            for (; node != nullptr; cnt++)
+            {
+                /* the node is in the stack, read it before the stack is reused */
+                auto next = node->next;
+                auto & list = free_stk_list[node->cls];
+                if (list.size() < pool_block_count())
+                    list.push_back(node->stk_mem);
+                else {
+                    node->next = overflow;
+                    overflow = node;
+                }
+                node = next;
+            }
+        }
+        drained.fetch_add(cnt, std::memory_order_relaxed);
+
+        while (overflow != nullptr)
+        {
+            auto next = overflow->next;
+            delete_stk(overflow->stk_mem, STACK_CLASS_SIZE[overflow->cls]);
+            overflow = next;
+        }
+    }
+
+    void * DynStackPool::pop_free_stk(std::size_t cls)
+    {
+        std::lock_guard lock(m_lock);
+        auto & list = free_stk_list[cls];
+        if (list.empty())
+            return nullptr;
+
+        auto ans = list.back();
+        list.pop_back();
+        return ans;
+    }
+
+    bool DynStackPool::push_free_stk(std::size_t cls, void * stk_mem)
+    {
+        std::lock_guard lock(m_lock);
+        auto & list = free_stk_list[cls];
+        if (list.size() >= pool_block_count())
+            return false;
+
+        list.push_back(stk_mem);
+        return true;
+    }
+
+    void * DynStackPool::new_stk(std::size_t stk_size)
+    {
+#ifdef __STACK_DYN_GUARD__
+        auto len = map_size(stk_size);
+        auto map = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK, -1, 0);
+        if (UNLIKELY(map == MAP_FAILED))
+            throw EMemoryErrors::CANNOT_CREATE_BLOCK;
+
+        /* lowest pages, an overflow faults here instead of running into the next stack */
+        if (UNLIKELY(mprotect(map, GUARD_SIZE, PROT_NONE) != 0))
+        {
+            munmap(map, len);
+            throw EMemoryErrors::CANNOT_CREATE_BLOCK;
+        }
+
+        if (numa_node >= 0)
+            numa_bind(static_cast<uint8_t *>(map) + GUARD_SIZE, len - GUARD_SIZE, numa_node);
+        return static_cast<uint8_t *>(map) + GUARD_SIZE;
+#else
+        return dyn_stk_pool.allocate(stk_size + STACK_RESERVE);
+#endif
+    }
+
+    void DynStackPool::delete_stk(void * stk_mem, [[maybe_unused]] std::size_t stk_size)
+    {
+#ifdef __STACK_DYN_GUARD__
+        munmap(static_cast<uint8_t *>(stk_mem) - GUARD_SIZE, map_size(stk_size));
+#else
+        dyn_stk_pool.deallocate(stk_mem);
+#endif
+    }
+#endif
 
     void DynStackPool::alloc_stk(Context *ctx) {
+        auto cls = stack_class(ctx->stk_dyn_hint);
+        auto stk_size = STACK_CLASS_SIZE[cls];
         ctx->stk_dyn_alloc = this;
-        ctx->stk_dyn_capacity = co::MAX_STACK_SIZE;
+        ctx->stk_dyn_capacity = stk_size;
 #ifdef __MEM_PMR__
-        ctx->stk_dyn_mem = dyn_stk_pool.allocate(STACK_SIZE, 64);
+        ctx->stk_dyn_mem = dyn_stk_pool.allocate(stk_size + STACK_RESERVE, 64);
 #else
-        ctx->stk_dyn_mem = dyn_stk_pool.allocate(STACK_SIZE);
+        if (remote_free.load(std::memory_order_relaxed) != nullptr)
+            drain_remote_free();
+        ctx->stk_dyn_mem = pop_hot_stk(cls);
+        if (ctx->stk_dyn_mem == nullptr)
+            ctx->stk_dyn_mem = pop_free_stk(cls);
+        if (ctx->stk_dyn_mem == nullptr)
+            ctx->stk_dyn_mem = new_stk(stk_size);
 #endif
-        ctx->stk_dyn = align_stk_ptr(reinterpret_cast<uint8_t *>((uint64_t) ctx->stk_dyn_mem + co::MAX_STACK_SIZE));
+        ctx->stk_dyn = align_stk_ptr(reinterpret_cast<uint8_t *>((uint64_t) ctx->stk_dyn_mem + stk_size));
         ctx->set_stack_dyn(ctx->stk_dyn);
     }
 
     void DynStackPool::free_stk(Context *ctx) {
 #ifdef __MEM_PMR__
-        dyn_stk_pool.deallocate(ctx->stk_dyn_mem, STACK_SIZE);
+        dyn_stk_pool.deallocate(ctx->stk_dyn_mem, ctx->stk_dyn_capacity + STACK_RESERVE);
 #else
-        dyn_stk_pool.deallocate(ctx->stk_dyn_mem);
+        auto cls = stack_class(ctx->stk_dyn_capacity);
+        if (is_owner())
+            push_hot_stk(cls, ctx->stk_dyn_mem);
+        else
+            push_remote_free(cls, ctx->stk_dyn_mem);
 #endif
         ctx->stk_dyn_mem = nullptr;
         ctx->stk_dyn_capacity = {};
         ctx->stk_dyn = nullptr;
         ctx->stk_dyn_alloc = nullptr;
     }
-}
\ No newline at end of file
+}
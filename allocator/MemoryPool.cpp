@@ -22,6 +22,7 @@
  */
 
 #include "include/MemoryPool.h"
+#include "../utils/include/numa_utils.h"
 #include <iostream>
 #include <mutex>
 #include <sys/mman.h>
@@ -33,10 +34,10 @@ namespace co {
         this->firstBlock = this->currentBlock = nullptr;
         this->defaultBlockSize = block_size;
         this->currentScope = nullptr;
-        this->createMemoryBlock(block_size);
         this->single_block = single_block;
         this->use_mmap = use_mmap;
         this->mmap_flag = mmap_flag;
+        this->createMemoryBlock(block_size);
     }
 
     MemoryPool::~MemoryPool() {
@@ -44,7 +45,10 @@ namespace co {
 
         while (block_iterator != nullptr) {
             SMemoryBlockHeader *next_iterator = block_iterator->next;
-            std::free(block_iterator);
+            if (!use_mmap)
+                std::free(block_iterator);
+            else
+                munmap(block_iterator, sizeof(SMemoryBlockHeader) + block_iterator->blockSize);
             block_iterator = next_iterator;
         }
     }
@@ -67,6 +71,8 @@ namespace co {
         block->offset = 0;
         block->numberOfAllocated = 0;
         block->numberOfDeleted = 0;
+        if (this->numa_node >= 0)
+            numa_bind(block, sizeof(SMemoryBlockHeader) + block_size, this->numa_node);
 
         if (this->firstBlock != nullptr) {
             block->next = nullptr;
@@ -80,6 +86,13 @@ namespace co {
         }
     }
 
+    void MemoryPool::bind_numa_node(int node) {
+        std::lock_guard<spin_lock> lock(m_lock);
+        this->numa_node = node;
+        for (auto block = this->firstBlock; block != nullptr; block = block->next)
+            numa_bind(block, sizeof(SMemoryBlockHeader) + block->blockSize, node);
+    }
+
     void *MemoryPool::allocate_unsafe(size_t instances) {
         size_t real_size = instances + (ALIGN - sizeof(SMemoryUnitHeader));
         if (real_size + sizeof(SMemoryUnitHeader) >= this->currentBlock->blockSize - this->currentBlock->offset
@@ -8,21 +8,20 @@
 #include <cassert>
 
 #include "../include/CoPrivate.h"
-#include "BitSetLockFree.h"
 #include "utils.h"
 #include "include/StackPool.h"
 
 #ifdef __STACK_STATIC__
 
 namespace co {
-    bool stack_data_verify(Context * co_ctx)
+    bool stack_data_verify(Context * ctx)
     {
-        auto * dyn = reinterpret_cast<uint8_t *>(co_ctx->stk_dyn_mem);
+        auto * dyn = reinterpret_cast<uint8_t *>(ctx->stk_dyn_mem);
         if (dyn == nullptr)
             return true;
 
-        auto * stk = reinterpret_cast<uint8_t *>(co_ctx->jmp_reg.sp);
-        auto * stk_end = reinterpret_cast<uint8_t *>(co_ctx->stk_real_bottom);
+        auto * stk = reinterpret_cast<uint8_t *>(ctx->jmp_reg.sp);
+        auto * stk_end = reinterpret_cast<uint8_t *>(ctx->stk_real_bottom);
         for (int i = 0; std::addressof(stk[i]) != stk_end; i++)
         {
             if (stk[i] != dyn[i])
@@ -32,12 +31,6 @@ namespace co {
         return true;
     }
 
-    StackPool::StackPool()
-    {
-        /* set all true */
-        freed_stack.flip();
-    }
-
     void StackPool::alloc_dyn_stk_mem(void * &mem_ptr, std::size_t size)
     {
     #ifdef __MEM_PMR__
@@ -47,93 +40,94 @@ namespace co {
     #endif
     }
 
-    void StackPool::write_back(StackInfo * info)
+    void StackPool::free_dyn_stk_mem(Context * ctx)
     {
-        Co_t * co = info->occupy_co;
-        if (co->co_ctx.stk_dyn_mem == nullptr)
-        {
-            co->co_ctx.stk_dyn_saver_alloc = &dyn_stk_saver_pool;
-            co->co_ctx.stk_dyn_capacity = 3 * co->co_ctx.stk_size / 2; // 1.5 * stk_size
-            alloc_dyn_stk_mem(co->co_ctx.stk_dyn_mem, co->co_ctx.stk_dyn_capacity);
-        } else if (co->co_ctx.stk_dyn_capacity <= co->co_ctx.stk_size)
-        {
+        if (ctx->stk_dyn_mem == nullptr)
+            return;
+
     #ifdef __MEM_PMR__
-            co->co_ctx.stk_dyn_saver_alloc->deallocate(co->co_ctx.stk_dyn_mem, co->co_ctx.stk_dyn_capacity);
+        ctx->stk_dyn_saver_alloc->deallocate(ctx->stk_dyn_mem, ctx->stk_dyn_capacity);
     #else
-            co->co_ctx.stk_dyn_saver_alloc->deallocate(co->co_ctx.stk_dyn_mem);
+        ctx->stk_dyn_saver_alloc->deallocate(ctx->stk_dyn_mem);
     #endif
-            co->co_ctx.stk_dyn_saver_alloc = &dyn_stk_saver_pool;
-            co->co_ctx.stk_dyn_capacity = 3 * co->co_ctx.stk_size / 2; // 1.5 * stk_size
-            alloc_dyn_stk_mem(co->co_ctx.stk_dyn_mem, co->co_ctx.stk_dyn_capacity);
-        }
-
-        co->co_ctx.stk_is_static = false;
-        co->co_ctx.stk_dyn_size = co->co_ctx.stk_size;
-        std::memcpy(co->co_ctx.stk_dyn_mem, reinterpret_cast<void*>(co->co_ctx.jmp_reg.sp), co->co_ctx.stk_size);
-        DASSERT(stack_data_verify(std::addressof(co->co_ctx)));
+        ctx->stk_dyn_saver_alloc = nullptr;
+        ctx->stk_dyn_mem = nullptr;
+        ctx->stk_dyn_capacity = 0;
     }
 
-    void StackPool::unique_assert(int stk_idx)
+    /* copy the used frames of the occupant out, the stack is free after it */
+    void StackPool::write_back(StackInfo * info)
     {
-        DASSERT(!running.get(stk_idx) && !freed_stack.get(stk_idx) && !released_co.get(stk_idx));
+        Co_t * co = info->occupy_co;
+        auto & ctx = co->ctx;
+        if (ctx.stk_dyn_capacity < ctx.stk_size)
+        {
+            free_dyn_stk_mem(&ctx);
+            ctx.stk_dyn_saver_alloc = &dyn_stk_saver_pool;
+            ctx.stk_dyn_capacity = 3 * ctx.stk_size / 2; // 1.5 * stk_size
+            alloc_dyn_stk_mem(ctx.stk_dyn_mem, ctx.stk_dyn_capacity);
+        }
+
+        ctx.stk_is_static = false;
+        ctx.stk_dyn_size = ctx.stk_size;
+        std::memcpy(ctx.stk_dyn_mem, reinterpret_cast<void*>(ctx.jmp_reg.sp), ctx.stk_size);
+        DASSERT(stack_data_verify(std::addressof(ctx)));
+
+        info->occupy_co = nullptr;
+        info->stk_status = StackInfo::FREED;
     }
 
+    /* frames hold addresses of the stack, the index is kept for the life of the coroutine */
     void StackPool::alloc_static_stk(Co_t * co)
     {
-        auto stk_ptr = stk[0].get_stk_bp_ptr();
-        stk[0].occupy_co = co;
-        co->co_ctx.occupy_stack = 0;
-        setup_co_static_stk(co, stk_ptr);
-        if (co->co_ctx.stk_size > 0)
-            std::memcpy(reinterpret_cast<void*>(co->co_ctx.jmp_reg.sp), co->co_ctx.stk_dyn_mem, co->co_ctx.stk_size);
+        auto & ctx = co->ctx;
+        if (ctx.occupy_stack < 0)
+            ctx.occupy_stack = static_cast<int32_t>(next_stack++ % co::STATIC_STK_NUM);
+
+        auto & info = stk[ctx.occupy_stack];
+        if (info.occupy_co != co)
+        {
+            if (info.occupy_co != nullptr)
+                write_back(std::addressof(info));
+
+            info.occupy_co = co;
+            ctx.stk_is_static = true;
+            ctx.static_stk_pool = this;
+            if (ctx.stk_real_bottom == nullptr)
+                ctx.set_stack(info.get_stk_bp_ptr());
+            else if (ctx.stk_size > 0)
+                std::memcpy(reinterpret_cast<void*>(ctx.jmp_reg.sp), ctx.stk_dyn_mem, ctx.stk_size);
+        }
+
+        info.stk_status = StackInfo::ACTIVE;
     }
 
     /* 由coroutine自己主动调用 */
-    /* coroutine stack 一定不在 released 队列 */
     void StackPool::destroy_stack(Co_t * co)
     {
-        int stk_idx = co->co_ctx.occupy_stack;
-        stk[stk_idx].stk_status = StackInfo::FREED;
-        stk[stk_idx].occupy_co = nullptr;
+        auto & ctx = co->ctx;
+        if (ctx.occupy_stack >= 0 && stk[ctx.occupy_stack].occupy_co == co)
+        {
+            stk[ctx.occupy_stack].occupy_co = nullptr;
+            stk[ctx.occupy_stack].stk_status = StackInfo::FREED;
+        }
 
-        if (co->co_ctx.stk_dyn_mem != nullptr)
-    #ifdef __MEM_PMR__
-            co->co_ctx.stk_dyn_saver_alloc->deallocate(co->co_ctx.stk_dyn_mem, co->co_ctx.stk_dyn_capacity);
-    #else
-            co->co_ctx.stk_dyn_saver_alloc->deallocate(co->co_ctx.stk_dyn_mem);
-    #endif
+        free_dyn_stk_mem(&ctx);
+        ctx.stk_dyn_size = 0;
+        ctx.stk_dyn = nullptr;
+        ctx.stk_dyn_real_bottom = nullptr;
 
-        co->co_ctx.stk_dyn_saver_alloc = nullptr;
-        co->co_ctx.stk_dyn_mem = nullptr;
-        co->co_ctx.stk_dyn_size = 0;
-        co->co_ctx.stk_dyn_capacity = 0;
-        co->co_ctx.stk_dyn = nullptr;
-        co->co_ctx.stk_dyn_real_bottom = nullptr;
-
-        co->co_ctx.stk_size = 0;
-        co->co_ctx.stk_is_static = false;
-        co->co_ctx.stk_real_bottom = nullptr;
-        co->co_ctx.occupy_stack = BitSetLockFree<>::INVALID_INDEX;
+        ctx.stk_size = 0;
+        ctx.stk_is_static = false;
+        ctx.stk_real_bottom = nullptr;
+        ctx.occupy_stack = -1;
     }
 
-    /* 由coroutine主动调用 */
-    /* 前提，coroutine stack空闲 */
+    /* coroutine 切出后调用, frames are written back lazily */
     void StackPool::release_stack(Co_t * co)
     {
-        write_back(std::addressof(stk[0]));
-
-        int stk_idx = co->co_ctx.occupy_stack;
-        stk[stk_idx].stk_status = StackInfo::RELEASED;
-        DEXPR(running.set(stk_idx, false);)
-        //released_co.set(stk_idx, true);
+        co->ctx.set_stk_size();
+        stk[co->ctx.occupy_stack].stk_status = StackInfo::RELEASED;
     }
-
-    void StackPool::setup_co_static_stk(Co_t* co, uint8_t * stk_ptr)
-    {
-        co->co_ctx.stk_is_static = true;
-        co->co_ctx.static_stk_pool = this;
-        co->co_ctx.set_stack(stk_ptr);
-    }
-
 }
-#endif
\ No newline at end of file
+#endif
@@ -4,45 +4,174 @@
 
 #pragma once
 
+#include <array>
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <vector>
+#include <csignal>
 #include <sys/mman.h>
 #include "MemoryPool.h"
+#include "../../utils/include/single_thread.h"
 #include "../../context/include/Context.h"
 #include "../../include/Coroutine.h"
+#include "../../include/CoDef.h"
 #ifdef __MEM_PMR__
 #include <memory_resource>
 #endif
 
+#if defined(__STACK_DYN_GUARD__) && defined(__MEM_PMR__)
+#error "__STACK_DYN_GUARD__ maps stacks itself, not with __MEM_PMR__"
+#endif
+#if defined(__STACK_DYN_RECLAIM__) && !defined(__STACK_DYN__)
+#error "__STACK_DYN_RECLAIM__ gives back pages of dyn stacks, needs __STACK_DYN__"
+#endif
+
 namespace co {
     class DynStackPool {
     public:
         constexpr static std::size_t STACK_ALIGN = 16;
         constexpr static std::size_t STACK_RESERVE = 8 * STACK_ALIGN;
         constexpr static std::size_t STACK_SIZE = co::MAX_STACK_SIZE + STACK_RESERVE;
-        constexpr static std::size_t POOL_BLOCK_COUNT = std::max((co::CPU_CORE * 8), 64);
+        constexpr static std::size_t MIN_POOL_BLOCK_COUNT = 64;
+        /* a stack size hint is rounded up to the smallest class holding it */
+        constexpr static std::array<std::size_t, 4> STACK_CLASS_SIZE{
+            16 * 1024,
+            64 * 1024,
+            256 * 1024,
+            co::MAX_STACK_SIZE
+        };
+        constexpr static std::size_t STACK_CLASS_COUNT = STACK_CLASS_SIZE.size();
+        constexpr static std::size_t PAGE_SIZE = 4096;
 
-#ifdef __MEM_PMR__
+        /* follow the runtime worker count */
+        static std::size_t pool_block_count();
+
+        /* 0: the largest class */
+        static std::size_t stack_class(std::size_t hint);
+
+#ifndef __MEM_PMR__
+        /* stacks freed by the owner worker per class, LIFO, the top pages of the latest are still in cache */
+        constexpr static std::size_t HOT_STK_COUNT = 4;
+
+        /* a stack freed by another thread, linked in the reserve above the stack */
+        struct remote_stk_t
+        {
+            remote_stk_t * next;
+            void * stk_mem;
+            std::size_t cls;
+        };
+
+        /* owner only, no lock */
+        std::array<std::array<void *, HOT_STK_COUNT>, STACK_CLASS_COUNT> hot_stk{};
+        std::array<std::size_t, STACK_CLASS_COUNT> hot_stk_count{};
+        /* pushed by other threads, moved to free_stk_list all at once by alloc_stk of the owner */
+        worker_atomic_t<remote_stk_t *> remote_free{};
+
+        /* freed stacks per class, up to pool_block_count() each, behind the hot stacks */
+        std::array<std::vector<void *>, STACK_CLASS_COUNT> free_stk_list{};
+        spin_lock m_lock{};
+
+        std::atomic<uint64_t> hot_hits{};
+        std::atomic<uint64_t> remote_frees{};
+        std::atomic<uint64_t> drained{};
+
+        /* the pool of the calling worker */
+        [[nodiscard]] bool is_owner() const;
+
+        void * pop_hot_stk(std::size_t cls);
+
+        void push_hot_stk(std::size_t cls, void * stk_mem);
+
+        void push_remote_free(std::size_t cls, void * stk_mem);
+
+        void drain_remote_free();
+
+        void * pop_free_stk(std::size_t cls);
+
+        bool push_free_stk(std::size_t cls, void * stk_mem);
+
+        void * new_stk(std::size_t stk_size);
+
+        void delete_stk(void * stk_mem, std::size_t stk_size);
+#endif
+
+#ifdef __STACK_DYN_GUARD__
+        /* [guard | stack], reserved with MAP_NORESERVE, pages are committed on touch */
+        /* a frame bigger than the guard could skip over it, the guard costs address space only */
+        constexpr static std::size_t GUARD_SIZE = 16 * PAGE_SIZE;
+        /* min size of the sigaltstack of a worker, the overflow report runs on it */
+        constexpr static std::size_t ALT_STACK_SIZE = 64 * 1024;
+
+        constexpr static std::size_t map_size(std::size_t stk_size)
+        {
+            return GUARD_SIZE + ((stk_size + STACK_RESERVE + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+        }
+
+        int numa_node{-1};
+
+        static struct sigaction prev_segv_act;
+
+        /* SIGSEGV on the guard of the running coroutine is reported, others go to the previous handler */
+        static void overflow_handler(int sig, siginfo_t * info, void * uc);
+
+        /* once, before workers start */
+        static void init_overflow_handler();
+
+        /* every worker, the handler can not run on an overflowed stack */
+        static void init_alt_stack();
+
+        ~DynStackPool();
+#elif defined(__MEM_PMR__)
         std::pmr::synchronized_pool_resource dyn_stk_pool{
             std::pmr::pool_options{
-                POOL_BLOCK_COUNT,
+                pool_block_count(),
                 STACK_SIZE
             }
         };
 #elif __STACK_DYN_MMAP__
         MemoryPool dyn_stk_pool
         {
-            POOL_BLOCK_COUNT * STACK_SIZE,
+            pool_block_count() * STACK_SIZE,
             false,
             true,
             MAP_GROWSDOWN | MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK
         };
 #else
-        MemoryPool dyn_stk_pool{POOL_BLOCK_COUNT * STACK_SIZE, false};
+        MemoryPool dyn_stk_pool{pool_block_count() * STACK_SIZE, false};
+#endif
+
+#ifdef __STACK_DYN_RECLAIM__
+        /* the red zone below sp may still be written by the frame that switched out */
+        constexpr static std::size_t RED_ZONE = 128;
+
+        /* coroutines running on stacks of this pool, reclaim walks them */
+        std::vector<Co_t *> live_co{};
+        spin_lock live_lock{};
+        /* mincore result of reclaim, under live_lock */
+        std::vector<unsigned char> resident{};
+        /* clock us of the next reclaim pass of the tick */
+        int64_t next_reclaim_us{};
+        std::atomic<uint64_t> reclaim_passes{};
+        std::atomic<uint64_t> reclaimed_bytes{};
+
+        void track(Co_t * co);
+
+        void untrack(Co_t * co);
+
+        /* madvise away pages below the saved sp of coroutines waiting at least idle_us, returns the bytes */
+        uint64_t reclaim(int64_t idle_us);
+
+        /* tick thread, a pass every stack_reclaim_ms */
+        void reclaim_tick();
 #endif
 
+        void bind_numa_node(int node);
+
+        /* owner only */
         void alloc_stk(Context *ctx);
 
+        /* any thread, a stack of another worker goes back by remote_free */
         void free_stk(Context *ctx);
     };
 }
\ No newline at end of file
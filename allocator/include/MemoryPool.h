@@ -92,6 +92,7 @@ namespace co {
         int mmap_flag{0};
         bool use_mmap{false};
         bool single_block{};
+        int numa_node{-1};
         spin_lock m_lock{};
 
         /**
@@ -103,6 +104,13 @@ namespace co {
          */
         void createMemoryBlock(size_t block_size = MEMORY_POOL_DEFAULT_BLOCK_SIZE);
 
+        /**
+         * Prefer numa node for all blocks of the pool, include the blocks created later
+         *
+         * @param int node numa node id
+         */
+        void bind_numa_node(int node);
+
         /**
          * Allocates memory in a pool
          *
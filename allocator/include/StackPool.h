@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
 
 #ifdef __MEM_PMR__
@@ -13,9 +14,7 @@
 #include "MemoryPool.h"
 #include "StackPoolDef.h"
 #include "../../include/Coroutine.h"
-#include "../../utils/include/spin_lock.h"
 #include "../../include/CoDef.h"
-#include "../data_structure/include/BitSetLockFree.h"
 #include "utils.h"
 
 namespace co {
@@ -31,28 +30,26 @@ namespace co {
         };
 
         uint8_t *stk{};
+        /* the coroutine whose frames are on the stack */
         Co_t *occupy_co{};
         uint8_t stk_status{FREED};
-        spin_lock m_write_back_lock{};
 
         StackInfo() { stk = static_cast<uint8_t *>(std::malloc(STACK_SIZE)); }
 
         ~StackInfo() { std::free(stk); }
 
-        void wait_write_back() { m_write_back_lock.wait_until_lockable(); }
-
-        void lock_write_back() { m_write_back_lock.lock(); }
-
-        void unlock_write_back() { m_write_back_lock.unlock(); }
-
         [[nodiscard]] uint8_t *get_stk_bp_ptr() const {
-            auto *ptr = &stk[co::MAX_STACK_SIZE];
+            auto *ptr = &stk[co::STATIC_STACK_SIZE];
             return align_stk_ptr(ptr);
         }
     };
 
+    /* shared stacks of a worker with __STACK_STATIC__ */
+    /* a coroutine keeps its stack index, its frames stay on the stack until another coroutine of the index runs */
+    /* then they are written back to a saver buffer of the used size, and copied in again on the next run */
     struct StackPool {
-        std::array<StackInfo, 1> stk{};
+        std::array<StackInfo, co::STATIC_STK_NUM> stk{};
+        uint32_t next_stack{};
 
 #ifdef __MEM_PMR__
         std::pmr::synchronized_pool_resource dyn_stk_saver_pool{get_default_pmr_opt()};
@@ -60,25 +57,16 @@ namespace co {
         MemoryPool dyn_stk_saver_pool{co::MAX_STACK_SIZE * 2, false};
 #endif
 
-        spin_lock m_lock{};
-        BitSetLockFree<co::STATIC_STK_NUM> freed_stack{};
-        BitSetLockFree<co::STATIC_STK_NUM> released_co{};
-        BitSetLockFree<co::STATIC_STK_NUM> running{};
-
-        StackPool();
-
         void alloc_dyn_stk_mem(void *&mem_ptr, std::size_t size);
 
-        void write_back(StackInfo *info);
+        void free_dyn_stk_mem(Context *ctx);
 
-        void setup_co_static_stk(Co_t *co, uint8_t *stk_ptr);
+        void write_back(StackInfo *info);
 
         void destroy_stack(Co_t *co);
 
         void release_stack(Co_t *co);
 
         void alloc_static_stk(Co_t *co);
-
-        void unique_assert(int);
     };
-}
\ No newline at end of file
+}
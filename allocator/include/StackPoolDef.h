@@ -7,4 +7,5 @@
 namespace co {
     struct StackInfo;
     struct StackPool;
+    struct Context;
 }
\ No newline at end of file
@@ -39,6 +39,8 @@ namespace co {
         void * stk_dyn_mem{};
         std::size_t stk_dyn_size{};
         uint32_t stk_dyn_capacity{};
+        /* stack size hint of alloc_stk, 0: MAX_STACK_SIZE */
+        uint32_t stk_dyn_hint{};
         DynStackPool *stk_dyn_alloc{};
 #ifdef __MEM_PMR__
         std::pmr::synchronized_pool_resource * stk_dyn_saver_alloc{};
@@ -46,6 +48,14 @@ namespace co {
         MemoryPool * stk_dyn_saver_alloc{};
 #endif
         uint8_t * stk_dyn_real_bottom{};
+#ifdef __STACK_DYN_RECLAIM__
+        /* clock us of the latest switch out */
+        int64_t stk_dyn_park_us{};
+        /* pages below sp are given back since then */
+        bool stk_dyn_reclaimed{};
+        /* index in DynStackPool::live_co, -1: untracked */
+        int32_t stk_dyn_live_idx{-1};
+#endif
 
         /* System V Abi calling convention */
         /* preserved across function calls */
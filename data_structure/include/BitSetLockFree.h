@@ -71,6 +71,11 @@ namespace co {
         long long change_first_expect_impl(bool expected, bool value) {
             long long ans = INVALID_INDEX;
             for (size_t i = 0; i < total_block; i++) {
+                /* skip the block without expected bit, avoid CAS */
+                auto cur_block = m_block[i].load(std::memory_order_relaxed);
+                if ((expected ? cur_block : ~cur_block) == 0)
+                    continue;
+
                 int bit_idx = block_bits;
                 auto modify_fn = [&bit_idx, expected, value](block_t cur) -> block_t {
                     if (expected)
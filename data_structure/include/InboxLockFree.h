@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+
+namespace co {
+    /* intrusive multi producer inbox, linked through T::*NEXT
+     * producer: push by CAS, never allocate, never full
+     * consumer: take all by one exchange
+     */
+    template<typename T, T * T::*NEXT>
+    class InboxLockFree
+    {
+    private:
+        alignas(__CACHE_LINE__) std::atomic<T *> m_head{};
+
+    public:
+        InboxLockFree() = default;
+        InboxLockFree(const InboxLockFree &) = delete;
+
+        /* any thread */
+        void push(T * x)
+        {
+            auto head = m_head.load(std::memory_order_relaxed);
+            do {
+                x->*NEXT = head;
+            } while (!m_head.compare_exchange_weak(
+                    head, x,
+                    std::memory_order_release,
+                    std::memory_order_relaxed
+            ));
+        }
+
+        /* return the list in push order, NEXT of the last one is nullptr */
+        T * pop_all()
+        {
+            auto head = m_head.exchange(nullptr, std::memory_order_acquire);
+            T * ans{};
+            while (head != nullptr)
+            {
+                auto next = head->*NEXT;
+                head->*NEXT = ans;
+                ans = head;
+                head = next;
+            }
+
+            return ans;
+        }
+
+        [[nodiscard]] bool empty() const { return m_head.load(std::memory_order_relaxed) == nullptr; }
+    };
+}
@@ -5,13 +5,13 @@
 #include "../../utils/include/spin_lock_sleep.h"
 
 namespace co {
-    template<typename T, typename Container>
+    template<typename T, typename Container, typename Lock = spin_lock_sleep>
     class alignas(__CACHE_LINE__) LockedContainer
     {
     private:
         Container m_data{};
         size_t m_size{};
-        spin_lock_sleep m_lock{};
+        Lock m_lock{};
     public:
         LockedContainer() = default;
 
@@ -5,14 +5,14 @@
 #include "../../utils/include/spin_lock_sleep.h"
 
 namespace co {
-    template<typename T, typename CMP = std::less<T>>
+    template<typename T, typename CMP = std::less<T>, typename Lock = spin_lock_sleep>
     class alignas(__CACHE_LINE__) MultiSetLock
     {
     public:
         using set_t = std::multiset<T, CMP>;
     private:
         set_t m_data{};
-        spin_lock_sleep m_lock{};
+        Lock m_lock{};
         size_t m_size{};
 
         std::atomic<size_t> * get_size() { return reinterpret_cast<std::atomic<size_t>*>(&m_size); }
@@ -106,14 +106,14 @@ namespace co {
         bool empty() { return size() == 0; }
     };
 
-    template<typename T, typename CMP = std::less<T>>
+    template<typename T, typename CMP = std::less<T>, typename Lock = spin_lock_sleep>
     class alignas(__CACHE_LINE__) MultiSetPmrLock
     {
     private:
         using set_t = std::pmr::multiset<T, CMP>;
 
         set_t m_data{&pool};
-        spin_lock_sleep m_lock{};
+        Lock m_lock{};
         std::pmr::unsynchronized_pool_resource pool{get_default_pmr_opt()};
         size_t m_size{};
 
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm>
 #include <utility>
 #include <vector>
 
@@ -10,9 +11,9 @@ namespace co {
     class QuaternaryHeap {
     private:
         /* x := [0, 3] */
-        constexpr inline int64_t get_son(int64_t fa, int x) { return ((fa - 1) << 2) + 2 + x; }
+        static constexpr int64_t get_son(int64_t fa, int x) { return ((fa - 1) << 2) + 2 + x; }
 
-        constexpr inline int64_t get_fa(int64_t son) { return (son + 2) >> 2; }
+        static constexpr int64_t get_fa(int64_t son) { return (son + 2) >> 2; }
 
         void pushup(int64_t u)
         {
@@ -36,14 +37,14 @@ namespace co {
             while (true)
             {
                 int64_t son = get_son(u, 0);
-                if (UNLIKELY(son > (cur_size >> 2)))
+                if (UNLIKELY(son >= cur_size))
                     break;
 
                 int64_t min_son = son;
                 mm_prefetch(std::addressof(m_data[son]), 0, 3);
                 for (int64_t i = son + 1; i < son + 4; i++)
                 {
-                    if (UNLIKELY(i > (cur_size >> 2)))
+                    if (UNLIKELY(i >= cur_size))
                         break;
                     if (m_cmp(m_data[i], m_data[min_son]))
                         min_son = i;
@@ -89,6 +90,22 @@ namespace co {
             return ans;
         }
 
+        /* moves the n largest to out in no order, the rest is heapified again, O(size) */
+        template<typename OutputIt>
+        void pop_max_n(int64_t n, OutputIt out)
+        {
+            n = std::min(n, size());
+            if (n <= 0)
+                return;
+
+            auto split = m_data.end() - n;
+            std::nth_element(m_data.begin() + 1, split, m_data.end(), m_cmp);
+            std::move(split, m_data.end(), out);
+            m_data.erase(split, m_data.end());
+            for (auto u = get_fa(size()); u >= 1; u--)
+                pushdown(u);
+        }
+
         template<typename F>
         void push(F && data)
         {
@@ -129,6 +146,19 @@ namespace co {
             return m_data[1];
         }
 
+        /* the largest is a leaf, O(size) */
+        T max() const
+        {
+            DASSERT(!empty());
+            auto ans = m_data.begin() + get_fa(size()) + 1;
+            for (auto it = ans + 1; it < m_data.end(); ++it)
+            {
+                if (m_cmp(*ans, *it))
+                    ans = it;
+            }
+            return *ans;
+        }
+
         template<class F>
         bool gc(F && should_we_gc = default_gc_strategy)
         {
@@ -13,13 +13,13 @@
 #include "../../utils/include/spin_lock_sleep.h"
 
 namespace co {
-    template<typename T, std::size_t N, typename Allocator = std::allocator<T>>
+    template<typename T, std::size_t N, typename Allocator = std::allocator<T>, typename Lock = spin_lock_sleep>
     class RingBufferLock {
     private:
         T * m_data{};
         size_t m_size{};
         size_t rear{}, front{};
-        spin_lock_sleep m_lock{};
+        Lock m_lock{};
         static_assert(N > 0);
 
         constexpr size_t mod_idx(size_t idx)
@@ -22,11 +22,22 @@ namespace co {
         MemoryPool sem_pool{};
 #endif
         MemoryPool invoker_pool{};
-#ifdef __STACK_STATIC
+#ifdef __STACK_STATIC__
         StackPool stk_pool{};
 #endif
         std::pmr::synchronized_pool_resource oth_pool{get_default_pmr_opt()};
         DynStackPool dyn_stk_pool{};
+
+        /* pmr pools rely on first-touch of the worker thread */
+        void bind_numa_node(int node)
+        {
+#ifndef __MEM_PMR__
+            co_pool.bind_numa_node(node);
+            sem_pool.bind_numa_node(node);
+#endif
+            invoker_pool.bind_numa_node(node);
+            dyn_stk_pool.bind_numa_node(node);
+        }
     };
 
     struct GlobalAllocatorGroup
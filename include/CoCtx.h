@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <cstdint>
 #include <thread>
 
@@ -14,6 +15,7 @@
 #include "../sched/include/SchedulerDef.h"
 #include "../timer/include/TimerDef.h"
 #include "AllocatorGroup.h"
+#include "Coroutine.h"
 #include "xor_shift_rand.h"
 
 namespace co {
@@ -43,10 +45,19 @@ namespace co {
     namespace co_ctx
     {
         extern bool is_init;
+        extern InitOptions options;
+        extern NumaTopology numa;
         extern std::shared_ptr<SchedManager> manager;
         extern AllocatorGroup * g_alloc;
         extern TSCNS clock;
+        /* time slice in tsc of nice - 20 */
+        extern std::array<uint64_t, 40> time_slice_tsc;
+#ifdef __SCHED_PREEMPT__
+        /* running time in tsc before async preemption */
+        extern uint64_t preempt_tsc;
+#endif
         extern std::shared_ptr<Epoller> epoller;
+        extern std::shared_ptr<BlockingPool> blocking_pool;
 #ifdef __DEBUG_SCHED__
         extern std::unordered_set<Co_t*> co_vec;
         extern std::unordered_multiset<Co_t*> running_co;
@@ -13,6 +13,7 @@
 #include "../allocator/include/MemoryPool.h"
 #include "../../sched/include/SchedulerDef.h"
 #include "../../sched/include/CfsSchedEntity.h"
+#include "../../utils/include/single_thread.h"
 
 namespace co {
     enum CoStatus {
@@ -32,8 +33,8 @@ namespace co {
     struct Co_t
     {
         bool is_main_co{};
-        std::atomic<uint8_t> status{CO_NEW};
-        spin_lock status_lock{};
+        worker_atomic_t<uint8_t> status{CO_NEW};
+        worker_lock_t<spin_lock> status_lock{};
         uint16_t wakeup_reason{};
 
         // 调度信息
@@ -43,6 +44,8 @@ namespace co {
         SchedEntity sched{};
 #endif
         Scheduler * scheduler{};
+        /* link of Scheduler::inbox */
+        Co_t * inbox_next{};
 
         /* 用于通道唤醒后接收数据
          */
@@ -51,7 +54,11 @@ namespace co {
 
         // 上下文
         Context ctx{};
-        spin_lock stk_active_lock{}; // 栈是否活跃
+        worker_lock_t<spin_lock> stk_active_lock{}; // 栈是否活跃
+#ifdef __SCHED_PREEMPT__
+        /* interrupted rip of async preemption */
+        uint64_t preempt_pc{};
+#endif
 
         // 分配器信息
 #ifdef __MEM_PMR__
@@ -62,7 +69,7 @@ namespace co {
 
         // await
         Co_t *await_callee{}; // await 谁
-        spin_lock await_caller_lock{};
+        worker_lock_t<spin_lock> await_caller_lock{};
         std::vector<Co_t *> await_caller{}; // 谁 await
 #ifdef __DEBUG_SEM_TRACE__
         void * sem_ptr{};
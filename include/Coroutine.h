@@ -1,18 +1,64 @@
 #pragma once
 
+#include <array>
+#include <chrono>
 #include <cstdint>
 #include <cxxabi.h>
 #include <exception>
+#include <iterator>
+#include <memory>
+#include <vector>
 
 #include "../utils/include/Invoker.h"
+#include "../utils/include/numa_utils.h"
 #include "../sched/include/CfsSched.h"
 
 namespace co {
 	constexpr static uint64_t MAX_STACK_SIZE = 1024 * 1024 * 2; // 1 MB
-	constexpr static uint16_t CPU_CORE = __CPU_CORE__;
 	constexpr static uint64_t STATIC_STACK_SIZE = 1024 * 1024 * 8; // 8MB
-	constexpr static uint64_t STATIC_STK_NUM = 256;
-	static_assert(CPU_CORE > 0);
+	constexpr static uint64_t STATIC_STK_NUM = 4; // shared stacks per worker
+#ifdef __STACK_STATIC__
+	constexpr static bool SHARED_STACK = true;
+#else
+	constexpr static bool SHARED_STACK = false;
+#endif
+	constexpr static uint32_t DEFAULT_TIME_SLICE_US = 2000; // 2ms
+	constexpr static uint32_t MIN_TIME_SLICE_US = 100;
+	constexpr static uint32_t DEFAULT_PREEMPT_US = 10000; // 10ms
+	constexpr static uint32_t DEFAULT_BLOCKING_THREADS = 64;
+	constexpr static uint32_t DEFAULT_BLOCKING_IDLE_MS = 10000; // 10s
+	constexpr static uint32_t DEFAULT_STACK_RECLAIM_MS = 10000; // 10s
+
+	enum CO_PIN_POLICY
+	{
+		PIN_NONE = 0,	// no cpu affinity
+		PIN_CORE,		// worker i pinned to cpu_list[i % cpu_list.size()]
+	};
+
+	struct InitOptions
+	{
+		/* 0: number of cpus in cpu_list */
+		uint16_t worker_count{};
+		/* empty: cpus from sched_getaffinity */
+		std::vector<int> cpu_list{};
+		int pin_policy{PIN_NONE};
+		/* group schedulers by numa node, bind worker memory to its node */
+		bool numa_aware{false};
+		/* numa topology, <numa_path>/node<N>/cpulist */
+		std::string numa_path{NumaTopology::DEFAULT_PATH};
+		/* time slice of nice 0 for maybe_yield, 0: DEFAULT_TIME_SLICE_US */
+		uint32_t time_slice_us{};
+		/* time slice of nice - 20, 0: time_slice_us scaled by cfs weigh */
+		std::array<uint32_t, 40> time_slice_nice_us{};
+		/* with __SCHED_PREEMPT__, preempt a coroutine running longer, 0: DEFAULT_PREEMPT_US */
+		uint32_t preempt_us{};
+		/* max threads of spawn_blocking, 0: DEFAULT_BLOCKING_THREADS */
+		uint32_t blocking_threads{};
+		/* an idle spawn_blocking thread exits after it, 0: DEFAULT_BLOCKING_IDLE_MS */
+		uint32_t blocking_idle_ms{};
+		/* with __STACK_DYN_RECLAIM__, the tick reclaims stack pages of coroutines waiting longer, 0: DEFAULT_STACK_RECLAIM_MS */
+		uint32_t stack_reclaim_ms{};
+	};
 
 	class CoUnInitializationException : public std::exception
 	{
@@ -38,25 +84,178 @@ namespace co {
 		[[nodiscard]] const char * what() const noexcept override { return "Co Destroy Before Close"; }
 	};
 
+	/* absolute deadline on std::chrono::steady_clock */
+	/* with __SCHED_EDF__, coroutines with a deadline run earliest deadline first, before cfs */
+	struct Deadline
+	{
+		std::chrono::steady_clock::time_point time{};
+	};
+
+	struct DeadlineStats
+	{
+		/* coroutines with a deadline finished */
+		uint64_t finished{};
+		/* finished after the deadline */
+		uint64_t missed{};
+		/* taken by thieves */
+		uint64_t stolen{};
+		/* taken by thieves with a deadline before one left to the victim */
+		uint64_t stolen_early{};
+	};
+
+	struct WakeBatchStats
+	{
+		/* applies of a WakeBatch, one per target scheduler of a flush */
+		uint64_t flushes{};
+		/* coroutines woken by them */
+		uint64_t wakeups{};
+	};
+
+	struct WakeAffineStats
+	{
+		/* wakeups moved to the scheduler of the waker */
+		uint64_t migrations{};
+	};
+
+	struct StackReclaimStats
+	{
+		/* reclaim passes of the tick */
+		uint64_t passes{};
+		/* bytes of stack pages given back by the tick and reclaim_stacks */
+		uint64_t reclaimed_bytes{};
+	};
+
+	struct StackCacheStats
+	{
+		/* stacks taken from the hot stacks of the worker */
+		uint64_t hot_hits{};
+		/* stacks freed by a thread other than the owner of their pool */
+		uint64_t remote_frees{};
+		/* remote frees moved back to free_stk_list by the owner */
+		uint64_t drained{};
+	};
+
+	/* attributes of a new coroutine */
+	struct CoAttr
+	{
+		int nice{PRIORITY_NORMAL};
+		/* SchedGroup handle, nullptr: the group of the creator */
+		void * group{};
+		/* steady_clock ns, 0: cfs */
+		int64_t deadline_ns{};
+		/* stack size hint, with __STACK_DYN__ rounded up to a stack class of 16 KB, 64 KB, 256 KB or MAX_STACK_SIZE, 0: MAX_STACK_SIZE */
+		std::size_t stack_size{};
+	};
+
 	std::pair<void *, void * (*)(void*, std::size_t)> get_invoker_alloc();
-	void * create(void * invoker, int nice);
+	void * alloc_invoker_batch(std::size_t size, std::size_t count, void ** out);
+	void * create(void * invoker, const CoAttr & attr);
+	void create_batch(void * const * invokers, void ** handles, std::size_t count, const CoAttr & attr);
     void destroy(void * handle);
 	void await_impl(void * handle);
+	void spawn_blocking_impl(InvokerBase * invoker);
     void yield();
+	bool maybe_yield();
     void sleep(std::chrono::microseconds duration);
     void sleep_until(std::chrono::microseconds end_time);
 	void init();
+	void init(const InitOptions & options);
+	uint16_t worker_count();
+	void * sched_group_create(int nice);
+	void sched_group_release(void * group);
+	DeadlineStats deadline_stats();
+	WakeBatchStats wake_batch_stats();
+	WakeAffineStats wake_affine_stats();
+	StackReclaimStats stack_reclaim_stats();
+	StackCacheStats stack_cache_stats();
+	/* on memory pressure, give back stack pages below the saved sp of coroutines waiting at least idle, returns the bytes */
+	uint64_t reclaim_stacks(std::chrono::milliseconds idle = std::chrono::milliseconds(0));
+
+	/* check the time slice every STRIDE iterations, for hot loops
+	 * for (uint64_t i = 0; i < n; i++) { co::safepoint(i); ... }
+	 */
+	template<uint64_t STRIDE = 64>
+	inline bool safepoint(uint64_t iter)
+	{
+		static_assert(STRIDE > 0 && is_pow_of_2(STRIDE));
+		if (LIKELY((iter & (STRIDE - 1)) != 0))
+			return false;
+
+		return maybe_yield();
+	}
+
+	/* counter form of safepoint, for loops without an index */
+	template<uint32_t STRIDE = 64>
+	class Safepoint
+	{
+	private:
+		static_assert(STRIDE > 0 && is_pow_of_2(STRIDE));
+		uint32_t count{};
+
+	public:
+		bool operator()() { return safepoint<STRIDE>(++count); }
+	};
+
+    /* task group with the cfs weigh of nice, with __SCHED_CFS_GROUP__ */
+    /* coroutines are picked among groups first, then within the group */
+    /* a coroutine created by a coroutine of the group joins the group too */
+    class SchedGroup
+    {
+    private:
+        void * handle{};
+    public:
+        explicit SchedGroup(int nice = PRIORITY_NORMAL) { handle = sched_group_create(nice); }
+        SchedGroup(const SchedGroup & oth) = delete;
+        SchedGroup(SchedGroup && oth) noexcept { swap(std::move(oth)); }
+
+        /* coroutines in the group keep it alive */
+        ~SchedGroup()
+        {
+            if (handle != nullptr)
+                sched_group_release(handle);
+        }
+
+        [[nodiscard]] void * get() const { return handle; }
+
+        void swap(SchedGroup && oth) { std::swap(handle, oth.handle); }
+    };
+
+    /* result slot of a coroutine, on the heap with __STACK_STATIC__ as the callee may run while the shared stack of the caller is written back */
+    template<typename Ret>
+    class RetBuf
+    {
+    private:
+        struct alignas(Ret) slot_t { uint8_t buf[sizeof(Ret)]; };
+#ifdef __STACK_STATIC__
+        std::unique_ptr<slot_t> slot{new slot_t};
+    public:
+        void * data() { return slot->buf; }
+#else
+        slot_t slot;
+    public:
+        void * data() { return slot.buf; }
+#endif
+        Ret take()
+        {
+            auto ptr = reinterpret_cast<Ret*>(data());
+            auto res = std::move(*ptr);
+            if constexpr (!std::is_trivially_destructible_v<Ret>)
+                ptr->~Ret();
+
+            return res;
+        }
+    };
 
     template<class Fn, class ... Args>
-    void * construct(int nice, bool is_await, void * buf, Fn && fn, Args &&... args)
+    void * construct(const CoAttr & attr, bool is_await, void * buf, Fn && fn, Args &&... args)
     {
         static_assert(std::is_invocable_v<Fn, Args...>);
         using Ret = std::invoke_result_t<Fn, Args...>;
-        assert(cfs_nice_in_range(nice));
+        assert(cfs_nice_in_range(attr.nice));
 
         using Invoker = Invoker<Fn, Args...>;
         void * handle{};
-        if (!is_await)
+        if (!is_await || SHARED_STACK)
         {
             auto [alloc_self, alloc_func] = get_invoker_alloc();
             auto invoker_memory = alloc_func(alloc_self, sizeof(Invoker));
@@ -65,15 +264,18 @@ namespace co {
             if constexpr (!std::is_same_v<void, Ret>)
                 invoker->buf = buf;
 
-            handle = create(invoker, nice);
+            handle = create(invoker, attr);
             if (handle == nullptr)
                 throw CoCreateException();
+
+            if (is_await)
+                await_impl(handle);
         } else {
             Invoker invoker{std::forward<Fn>(fn), std::forward<Args>(args)...};
             if constexpr (!std::is_same_v<void, Ret>)
                 invoker.buf = buf;
 
-            handle = create(std::addressof(invoker), nice);
+            handle = create(std::addressof(invoker), attr);
             if (UNLIKELY(handle == nullptr))
                 throw CoCreateException();
 
@@ -88,7 +290,7 @@ namespace co {
     {
     private:
 		void * handle{};
-        uint8_t buf[sizeof(Ret)];
+        RetBuf<Ret> buf{};
     public:
 		Co() = default;
         Co(const Co & oth) = delete;
@@ -98,7 +300,7 @@ namespace co {
 		{
             static_assert(std::is_invocable_v<Fn, Args...>);
             static_assert(std::is_same_v<Ret, std::invoke_result_t<Fn, Args...>>);
-            handle = construct(nice, false, reinterpret_cast<void*>(buf), std::forward<Fn>(fn), std::forward<Args>(args)...);
+            handle = construct(CoAttr{.nice = nice}, false, buf.data(), std::forward<Fn>(fn), std::forward<Args>(args)...);
 		}
 
         template<typename Fn, typename ... Args>
@@ -106,7 +308,32 @@ namespace co {
         {
             static_assert(std::is_invocable_v<Fn, Args...>);
             static_assert(std::is_same_v<Ret, std::invoke_result_t<Fn, Args...>>);
-            handle = construct(PRIORITY_NORMAL, false, reinterpret_cast<void*>(buf), std::forward<Fn>(fn), std::forward<Args>(args)...);
+            handle = construct(CoAttr{}, false, buf.data(), std::forward<Fn>(fn), std::forward<Args>(args)...);
+        }
+
+        template<typename Fn, typename ... Args>
+        Co(SchedGroup & group, Fn && fn, Args &&... args)
+        {
+            static_assert(std::is_invocable_v<Fn, Args...>);
+            static_assert(std::is_same_v<Ret, std::invoke_result_t<Fn, Args...>>);
+            handle = construct(CoAttr{.group = group.get()}, false, buf.data(), std::forward<Fn>(fn), std::forward<Args>(args)...);
+        }
+
+        template<typename Fn, typename ... Args>
+        Co(Deadline deadline, Fn && fn, Args &&... args)
+        {
+            static_assert(std::is_invocable_v<Fn, Args...>);
+            static_assert(std::is_same_v<Ret, std::invoke_result_t<Fn, Args...>>);
+            auto deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time.time_since_epoch()).count();
+            handle = construct(CoAttr{.deadline_ns = deadline_ns}, false, buf.data(), std::forward<Fn>(fn), std::forward<Args>(args)...);
+        }
+
+        template<typename Fn, typename ... Args>
+        Co(CoAttr attr, Fn && fn, Args &&... args)
+        {
+            static_assert(std::is_invocable_v<Fn, Args...>);
+            static_assert(std::is_same_v<Ret, std::invoke_result_t<Fn, Args...>>);
+            handle = construct(attr, false, buf.data(), std::forward<Fn>(fn), std::forward<Args>(args)...);
         }
 
         Co(Co && co) noexcept { swap(std::move(co)); }
@@ -120,15 +347,14 @@ namespace co {
         Ret await()
         {
             await_impl(handle);
-
-            auto res = std::move(*reinterpret_cast<Ret*>(buf));
-            if constexpr (!std::is_trivially_destructible_v<Ret>)
-                reinterpret_cast<Ret*>(buf)->~Ret();
-
-            return res;
+            return buf.take();
         }
 
-		void swap(Co && co) { std::swap(handle, co.handle); }
+		void swap(Co && co)
+        {
+            std::swap(handle, co.handle);
+            std::swap(buf, co.buf);
+        }
     };
 
     template<>
@@ -143,13 +369,32 @@ namespace co {
         template<typename Fn, typename ... Args>
         Co(int nice, Fn && fn, Args &&... args)
         {
-            handle = construct(nice, false, nullptr, std::forward<Fn>(fn), std::forward<Args>(args)...);
+            handle = construct(CoAttr{.nice = nice}, false, nullptr, std::forward<Fn>(fn), std::forward<Args>(args)...);
         }
 
         template<typename Fn, typename ... Args>
         explicit Co(Fn && fn, Args &&... args)
         {
-            handle = construct(PRIORITY_NORMAL, false, nullptr, std::forward<Fn>(fn), std::forward<Args>(args)...);
+            handle = construct(CoAttr{}, false, nullptr, std::forward<Fn>(fn), std::forward<Args>(args)...);
+        }
+
+        template<typename Fn, typename ... Args>
+        Co(SchedGroup & group, Fn && fn, Args &&... args)
+        {
+            handle = construct(CoAttr{.group = group.get()}, false, nullptr, std::forward<Fn>(fn), std::forward<Args>(args)...);
+        }
+
+        template<typename Fn, typename ... Args>
+        Co(Deadline deadline, Fn && fn, Args &&... args)
+        {
+            auto deadline_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time.time_since_epoch()).count();
+            handle = construct(CoAttr{.deadline_ns = deadline_ns}, false, nullptr, std::forward<Fn>(fn), std::forward<Args>(args)...);
+        }
+
+        template<typename Fn, typename ... Args>
+        Co(CoAttr attr, Fn && fn, Args &&... args)
+        {
+            handle = construct(attr, false, nullptr, std::forward<Fn>(fn), std::forward<Args>(args)...);
         }
 
         Co(Co && co) noexcept { swap(std::move(co)); }
@@ -168,6 +413,142 @@ namespace co {
         void swap(Co && co) { std::swap(handle, co.handle); }
     };
 
+    /* coroutines created by spawn_batch, await them before destroy */
+    template<typename Ret>
+    class TaskBatch
+    {
+    private:
+        struct alignas(Ret) slot_t { uint8_t buf[sizeof(Ret)]; };
+
+        std::vector<void *> handles{};
+        std::unique_ptr<slot_t[]> slots{};
+    public:
+        TaskBatch() = default;
+        TaskBatch(const TaskBatch & oth) = delete;
+        TaskBatch(TaskBatch && oth) noexcept { swap(std::move(oth)); }
+
+        explicit TaskBatch(std::size_t count) : handles(count), slots(new slot_t[count]) {}
+
+        ~TaskBatch()
+        {
+            for (auto handle : handles)
+            {
+                if (handle != nullptr)
+                    co::destroy(handle);
+            }
+        }
+
+        [[nodiscard]] std::size_t size() const { return handles.size(); }
+
+        void ** handle_data() { return handles.data(); }
+
+        void * buf_data(std::size_t idx) { return slots[idx].buf; }
+
+        Ret await(std::size_t idx)
+        {
+            await_impl(handles[idx]);
+
+            auto ptr = reinterpret_cast<Ret*>(slots[idx].buf);
+            auto res = std::move(*ptr);
+            if constexpr (!std::is_trivially_destructible_v<Ret>)
+                ptr->~Ret();
+
+            return res;
+        }
+
+        std::vector<Ret> await_all()
+        {
+            std::vector<Ret> ans{};
+            ans.reserve(handles.size());
+            for (std::size_t i = 0; i < handles.size(); i++)
+                ans.push_back(await(i));
+
+            return ans;
+        }
+
+        void swap(TaskBatch && oth)
+        {
+            std::swap(handles, oth.handles);
+            std::swap(slots, oth.slots);
+        }
+    };
+
+    template<>
+    class TaskBatch<void>
+    {
+    private:
+        std::vector<void *> handles{};
+    public:
+        TaskBatch() = default;
+        TaskBatch(const TaskBatch & oth) = delete;
+        TaskBatch(TaskBatch && oth) noexcept { swap(std::move(oth)); }
+
+        explicit TaskBatch(std::size_t count) : handles(count) {}
+
+        ~TaskBatch()
+        {
+            for (auto handle : handles)
+            {
+                if (handle != nullptr)
+                    co::destroy(handle);
+            }
+        }
+
+        [[nodiscard]] std::size_t size() const { return handles.size(); }
+
+        void ** handle_data() { return handles.data(); }
+
+        void * buf_data(std::size_t) { return nullptr; }
+
+        void await(std::size_t idx) { await_impl(handles[idx]); }
+
+        void await_all()
+        {
+            for (auto handle : handles)
+                await_impl(handle);
+        }
+
+        void swap(TaskBatch && oth) { std::swap(handles, oth.handles); }
+    };
+
+    /* fn(elem) for each elem of range */
+    /* invoker memory is allocated under one pool lock, each scheduler is applied once */
+    template<typename Range, typename Fn>
+    auto spawn_batch(Range && range, Fn && fn, const CoAttr & attr)
+    {
+        using Elem = std::decay_t<decltype(*std::begin(range))>;
+        using Func = std::decay_t<Fn>;
+        using Invoker = Invoker<Func, Elem>;
+        using Ret = typename Invoker::Ret;
+        assert(cfs_nice_in_range(attr.nice));
+
+        auto count = static_cast<std::size_t>(std::distance(std::begin(range), std::end(range)));
+        TaskBatch<Ret> batch{count};
+        if (count == 0)
+            return batch;
+
+        std::vector<void *> invokers(count);
+        auto alloc_self = alloc_invoker_batch(sizeof(Invoker), count, invokers.data());
+        std::size_t idx = 0;
+        for (auto && elem : range)
+        {
+            auto invoker = new (invokers[idx]) Invoker(Func(fn), Elem(elem));
+            invoker->allocator = alloc_self;
+            if constexpr (!std::is_same_v<void, Ret>)
+                invoker->buf = batch.buf_data(idx);
+            idx++;
+        }
+
+        create_batch(invokers.data(), batch.handle_data(), count, attr);
+        return batch;
+    }
+
+    template<typename Range, typename Fn>
+    auto spawn_batch(Range && range, Fn && fn, int nice = PRIORITY_NORMAL)
+    {
+        return spawn_batch(std::forward<Range>(range), std::forward<Fn>(fn), CoAttr{.nice = nice});
+    }
+
     template<typename Fn, typename ... Args, typename Ret = std::invoke_result_t<Fn, Args...>>
     Ret await(Fn && fn, Args &&... args)
     {
@@ -177,7 +558,7 @@ namespace co {
         if constexpr (std::is_same_v<void, Ret>)
         {
             auto handle = construct(
-                    nice,
+                    CoAttr{.nice = nice},
                     true,
                     nullptr,
                     std::forward<Fn>(fn),
@@ -187,21 +568,17 @@ namespace co {
             return;
         }
 
-        uint8_t buf[sizeof(Ret)];
+        RetBuf<Ret> buf{};
         auto handle = construct(
-                nice,
+                CoAttr{.nice = nice},
                 true,
-                reinterpret_cast<Ret*>(buf),
+                buf.data(),
                 std::forward<Fn>(fn),
                 std::forward<Args>(args)...
         );
         co::destroy(handle);
 
-        auto res = std::move(*reinterpret_cast<Ret*>(buf));
-        if constexpr (!std::is_trivially_destructible_v<Ret>)
-            reinterpret_cast<Ret*>(buf)->~Ret();
-
-        return res;
+        return buf.take();
     }
 
     template<typename Fn, typename ... Args, typename Ret = std::invoke_result_t<Fn, Args...>>
@@ -211,7 +588,7 @@ namespace co {
         if constexpr (std::is_same_v<void, Ret>)
         {
             auto handle = construct(
-                    nice,
+                    CoAttr{.nice = nice},
                     true,
                     nullptr,
                     std::forward<Fn>(fn),
@@ -221,20 +598,43 @@ namespace co {
             return;
         }
 
-        uint8_t buf[sizeof(Ret)];
+        RetBuf<Ret> buf{};
         auto handle = construct(
-                nice,
+                CoAttr{.nice = nice},
                 true,
-                reinterpret_cast<Ret*>(buf),
+                buf.data(),
                 std::forward<Fn>(fn),
                 std::forward<Args>(args)...
         );
         co::destroy(handle);
 
-        auto res = std::move(*reinterpret_cast<Ret*>(buf));
-        if constexpr (!std::is_trivially_destructible_v<Ret>)
-            reinterpret_cast<Ret*>(buf)->~Ret();
+        return buf.take();
+    }
+
+    /* run fn(args...) on the blocking pool, the caller waits as CO_WAITING and its scheduler runs others */
+    /* for blocking syscalls and slow c libraries, an exception of fn is rethrown to the caller */
+    template<typename Fn, typename ... Args, typename Ret = std::invoke_result_t<Fn, Args...>>
+    Ret spawn_blocking(Fn && fn, Args &&... args)
+    {
+        static_assert(std::is_invocable_v<Fn, Args...>);
+
+#ifdef __STACK_STATIC__
+        /* the blocking thread touches the invoker while other coroutines run on the shared stack */
+        auto invoker_holder = std::make_unique<Invoker<Fn, Args...>>(std::forward<Fn>(fn), std::forward<Args>(args)...);
+        auto & invoker = *invoker_holder;
+#else
+        Invoker<Fn, Args...> invoker{std::forward<Fn>(fn), std::forward<Args>(args)...};
+#endif
+        if constexpr (std::is_same_v<void, Ret>)
+        {
+            spawn_blocking_impl(std::addressof(invoker));
+            return;
+        } else {
+            RetBuf<Ret> buf{};
+            invoker.buf = buf.data();
+            spawn_blocking_impl(std::addressof(invoker));
 
-        return res;
+            return buf.take();
+        }
     }
 }
\ No newline at end of file
@@ -9,6 +9,8 @@
 #include <vector>
 #include <numbers>
 #include <numeric>
+#include <filesystem>
+#include <fstream>
 
 #include "./include/Coroutine.h"
 #include "spin_lock.h"
@@ -231,6 +233,36 @@ void ring_queue_test()
     }
 }
 
+void numa_topology_test()
+{
+    std::cout << "numa topology test" << std::endl;
+
+    namespace fs = std::filesystem;
+    auto root = fs::temp_directory_path() / "co_fake_numa";
+    fs::remove_all(root);
+    fs::create_directories(root / "node0");
+    fs::create_directories(root / "node1");
+    fs::create_directories(root / "power");
+    std::ofstream(root / "node0" / "cpulist") << "0-1,4\n";
+    std::ofstream(root / "node1" / "cpulist") << "2-3,5-6\n";
+
+    assert((co::parse_cpu_list("0-2,7,9-10\n") == std::vector<int>{0, 1, 2, 7, 9, 10}));
+
+    auto topo = co::NumaTopology::load(root.string());
+    assert(topo.node_count == 2);
+    for (int cpu : {0, 1, 4})
+        assert(topo.node_of_cpu(cpu) == 0);
+    for (int cpu : {2, 3, 5, 6})
+        assert(topo.node_of_cpu(cpu) == 1);
+    /* unknown cpu fallback to node 0 */
+    assert(topo.node_of_cpu(64) == 0);
+
+    assert(co::NumaTopology::load((root / "missing").string()).node_count == 1);
+    fs::remove_all(root);
+
+    std::cout << "numa topology test success" << std::endl;
+}
+
 int main()
 {
 	std::cout << "main entry" << std::endl;
@@ -239,8 +271,10 @@ int main()
     //queue_lock_free_test();
 	//bitset_test();
     //ring_queue_test();
+    //numa_topology_test();
 
-	co::init();
+	/* a short stack reclaim interval, stack_reclaim_test covers the tick pass with it */
+	co::init(co::InitOptions{.stack_reclaim_ms = 200});
     std::cout << "coroutine initilization compelete" << std::endl;
 	test();
 }
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#include "include/BlockingPool.h"
+#include "include/Scheduler.h"
+#include "../include/CoCtx.h"
+
+namespace co {
+    BlockingPool::BlockingPool(uint32_t max_threads, std::chrono::milliseconds idle_timeout)
+    {
+        if (UNLIKELY(max_threads == 0))
+            throw CoInitializationException();
+
+        this->max_threads = max_threads;
+        this->idle_timeout = idle_timeout;
+    }
+
+    void BlockingPool::submit(BlockingTask * task)
+    {
+        bool start_thread = false;
+        {
+            std::lock_guard lock(m_lock);
+            task->next = nullptr;
+            if (tail != nullptr)
+                tail->next = task;
+            else
+                head = task;
+            tail = task;
+            queued++;
+
+            /* idle threads are not enough for the queued tasks */
+            if (queued > idle_count && thread_count < max_threads)
+            {
+                thread_count++;
+                start_thread = true;
+            }
+        }
+
+        if (start_thread)
+            std::thread{[this]() { worker(); }}.detach();
+        else
+            m_cond.notify_one();
+    }
+
+    uint32_t BlockingPool::threads()
+    {
+        std::lock_guard lock(m_lock);
+        return thread_count;
+    }
+
+    /* under m_lock, nullptr if idle for idle_timeout, the thread is retired */
+    BlockingTask * BlockingPool::pop_task(std::unique_lock<std::mutex> & lock)
+    {
+        while (head == nullptr)
+        {
+            idle_count++;
+            auto res = m_cond.wait_for(lock, idle_timeout);
+            idle_count--;
+            if (res == std::cv_status::timeout && head == nullptr)
+            {
+                thread_count--;
+                return nullptr;
+            }
+        }
+
+        auto task = head;
+        head = task->next;
+        if (head == nullptr)
+            tail = nullptr;
+        queued--;
+        return task;
+    }
+
+    void BlockingPool::run_task(BlockingTask * task)
+    {
+        try {
+            task->invoker->operator()();
+        } catch (...) {
+            task->exception = std::current_exception();
+        }
+
+        /* back to its scheduler, task is invalid after apply */
+        co_ctx::manager->apply(task->co);
+    }
+
+    void BlockingPool::worker()
+    {
+        /* started by a worker, do not share its pinned cpu */
+        if (co_ctx::options.pin_policy != PIN_NONE)
+        {
+            cpu_set_t cpu_set{};
+            CPU_ZERO(&cpu_set);
+            for (auto cpu : co_ctx::options.cpu_list)
+                CPU_SET(cpu, &cpu_set);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+        }
+
+        std::unique_lock lock(m_lock);
+        while (true)
+        {
+            auto task = pop_task(lock);
+            if (task == nullptr)
+                return;
+
+            lock.unlock();
+            run_task(task);
+            lock.lock();
+        }
+    }
+}
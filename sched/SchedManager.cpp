@@ -2,15 +2,45 @@
 // Created by hzj on 25-1-14.
 //
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <numeric>
 #include <vector>
 
 #include "../include/CoPrivate.h"
 #include "include/Scheduler.h"
+#include "include/WakeBatch.h"
 
 namespace co {
 
+    static uint32_t manager_rand()
+    {
+        /* the rand state of another worker is not touched after a migration */
+        PreemptGuard guard{};
+        auto loc = co_ctx::loc.get();
+        if (LIKELY(loc != nullptr))
+            return loc->rand();
+
+        /* thread without local_t, e.g. epoller */
+        static thread_local xor_shift_rand_64 rand{reinterpret_cast<uint64_t>(&rand) | 1};
+        return rand();
+    }
+
+    SchedManager::SchedManager(int thread_count)
+    {
+        if (UNLIKELY(thread_count <= 0 || (size_t) thread_count > MAX_SCHEDULER_COUNT))
+            throw CoInitializationException();
+
+        schedulers.resize(thread_count);
+        max_spinning = std::max<size_t>(thread_count / MAX_SPINNING_RATIO, 1);
+        for (size_t i = 1; i <= (size_t) thread_count; i++)
+        {
+            if (std::gcd(i, (size_t) thread_count) == 1)
+                steal_strides.push_back(i);
+        }
+    }
+
     void SchedManager::apply_impl(Co_t *co, int flag)
     {
         // 协程运行中
@@ -20,41 +50,112 @@ namespace co {
         if (UNLIKELY(co->status == CO_READY && co->scheduler != nullptr))
             assert(false);
 
-        /* back to origin thread */
+        auto scheduler = schedulers[wake_target(co)];
+#ifdef __SINGLE_THREAD__
+        /* other threads only touch the inbox */
+        if (!scheduler->is_owner())
+            flag = APPLY_LAZY;
+#endif
+        if (flag == APPLY_NORMAL)
+            scheduler->apply_ready(co);
+        else if (flag == APPLY_LAZY)
+            scheduler->apply_ready_lazy(co);
+        else
+            scheduler->apply_ready_eager(co);
+    }
+
+    /* back to origin thread, otherwise placed by pick_scheduler */
+    int SchedManager::wake_target(Co_t *co)
+    {
         if (co->sched.occupy_thread != -1)
         {
-            if (flag == APPLY_NORMAL)
-                schedulers.at(co->sched.occupy_thread)->apply_ready(co);
-            else if (flag == APPLY_EAGER)
-                schedulers.at(co->sched.occupy_thread)->apply_ready_eager(co);
-            else
-                schedulers.at(co->sched.occupy_thread)->apply_ready_lazy(co);
-
-            return;
+#ifdef __SCHED_WAKE_AFFINE__
+            co->sched.occupy_thread = wake_affine(co);
+#endif
+            return co->sched.occupy_thread;
         }
 
-        int min_scheduler_idx = 0;
-        uint64_t min_balance = INF;
-        for (size_t i = 0; i < schedulers.size(); i++)
+        co->sched.occupy_thread = pick_scheduler();
+        return co->sched.occupy_thread;
+    }
+
+#ifdef __SCHED_WAKE_AFFINE__
+    /* like wake_affine, woken on a scheduler thread, the data made by the waker is hot there */
+    /* move to the waker if the origin is busy and the waker is light, on the same numa node */
+    int SchedManager::wake_affine(Co_t * co)
+    {
+        auto prev_idx = co->sched.occupy_thread;
+        if (!co->sched.can_migration)
+            return prev_idx;
+
+        auto loc = co_ctx::loc.get();
+        if (loc == nullptr || loc->scheduler == nullptr || !loc->scheduler->is_owner())
+            return prev_idx;
+
+        auto waker = loc->scheduler;
+        auto prev = schedulers[prev_idx];
+        if (waker == prev || waker->numa_node != prev->numa_node)
+            return prev_idx;
+
+        auto prev_load = prev->get_load();
+        if (prev_load < WAKE_AFFINE_MIN_LOAD || prev_load < (waker->get_load() + 1) * WAKE_AFFINE_RATIO)
+            return prev_idx;
+
+        /* rate limited, a coroutine woken by many schedulers doesn't bounce between them */
+        auto now = co_ctx::clock.rdns();
+        if (now - co->sched.wake_affine_ns < WAKE_AFFINE_INTERVAL)
+            return prev_idx;
+
+        co->sched.wake_affine_ns = now;
+        waker->wake_affine_pulls.fetch_add(1, std::memory_order_relaxed);
+        return waker->this_thread_id;
+    }
+#endif
+
+    /* own empty scheduler, then idle scheduler, otherwise power of two choices */
+    int SchedManager::pick_scheduler()
+    {
+        auto loc = co_ctx::loc.get();
+        int local_idx = -1;
+        if (loc != nullptr && loc->scheduler != nullptr && loc->scheduler->is_owner())
+            local_idx = loc->scheduler->this_thread_id;
+
+        /* the spawner will yield soon, keep it local rather than wake another thread */
+        if (local_idx >= 0 && schedulers[local_idx]->get_load() == 0)
+            return local_idx;
+
+        if (idle_count.load(std::memory_order_relaxed) > 0)
         {
-            auto balance = schedulers[i]->get_load();
-            //std::cout << "<" << balance << ", " << i << ">" << std::endl;
-            if (balance < min_balance) {
-                min_balance = balance;
-                min_scheduler_idx = i;
+            auto idx = idle_schedulers.change_first_expect(true, false);
+            if (idx != BitSetLockFree<>::INVALID_INDEX)
+            {
+                idle_count.fetch_sub(1, std::memory_order_relaxed);
+                return idx;
             }
         }
 
-        co->sched.occupy_thread = min_scheduler_idx;
-        if (flag == APPLY_NORMAL)
-            schedulers[min_scheduler_idx]->apply_ready(co);
-        else if (flag == APPLY_LAZY)
-            schedulers[min_scheduler_idx]->apply_ready_lazy(co);
-        else
-            schedulers[min_scheduler_idx]->apply_ready_eager(co);
+        auto count = schedulers.size();
+        if (UNLIKELY(count == 1))
+            return 0;
+
+        /* one choice is the local scheduler if any, keeps the spawn tree depth first */
+        auto rand = manager_rand();
+        size_t a = local_idx >= 0 ? local_idx : rand % count;
+        size_t b = (rand >> 16) % (count - 1);
+        b = b >= a ? b + 1 : b;
+        return schedulers[a]->get_load() <= schedulers[b]->get_load() ? a : b;
+    }
+
+    void SchedManager::set_idle(int idx, bool idle)
+    {
+        if (idle_schedulers.compare_set(idx, !idle, idle, std::memory_order_acq_rel))
+            idle_count.fetch_add(idle ? 1 : -1, std::memory_order_relaxed);
     }
 
     void SchedManager::apply(Co_t *co) {
+        if (auto batch = WakeBatch::current(); batch != nullptr)
+            return batch->add(co);
+
         apply_impl(co, APPLY_NORMAL);
     }
 
@@ -66,14 +167,42 @@ namespace co {
         apply_impl(co, APPLY_LAZY);
     }
 
+    /* contiguous slice per scheduler, one lock and one wakeup for each */
+    void SchedManager::apply_batch(const std::vector<Co_t *> & co_vec)
+    {
+        if (co_vec.empty())
+            return;
+
+        auto count = std::min(schedulers.size(), co_vec.size());
+        auto slice = (co_vec.size() + count - 1) / count;
+        auto first = pick_scheduler();
+        std::vector<Co_t *> part{};
+        part.reserve(slice);
+        for (size_t i = 0; i * slice < co_vec.size(); i++)
+        {
+            auto begin = co_vec.begin() + i * slice;
+            auto end = co_vec.begin() + std::min((i + 1) * slice, co_vec.size());
+            int idx = (first + i) % schedulers.size();
+            part.assign(begin, end);
+            for (auto co : part)
+                co->sched.occupy_thread = idx;
+
+            auto scheduler = schedulers[idx];
+            auto cur_sched_lock = std::unique_lock(scheduler->sched_lock, std::defer_lock);
+            scheduler->apply_ready_all(part, cur_sched_lock);
+        }
+    }
+
     void SchedManager::wakeup_await_co_all(Co_t *await_callee) {
         DASSERT(await_callee != nullptr);
+        /* flushed after await_caller_lock is released */
+        WakeBatch batch{};
         std::lock_guard lock(await_callee->await_caller_lock);
         auto & caller_q = await_callee->await_caller;
         for (auto co : caller_q)
         {
             co->await_callee = nullptr;
-            apply(co);
+            batch.add(co);
         }
         caller_q.clear();
         caller_q.shrink_to_fit();
@@ -81,44 +210,68 @@ namespace co {
 
     void SchedManager::stealing_work(int thread_from, std::vector<Co_t *> &res) {
         DASSERT(thread_from >= 0 && (size_t) thread_from < schedulers.size());
-#ifdef __STACK_STATIC__
-        return;
-#endif
-        for (size_t i = 0; i < schedulers.size(); i++) {
-            if ((int) i == thread_from)
+        /* bound the spinning thieves */
+        if (spinning_count.load(std::memory_order_relaxed) >= max_spinning)
+            return;
+        if (spinning_count.fetch_add(1, std::memory_order_acquire) >= max_spinning)
+        {
+            spinning_count.fetch_sub(1, std::memory_order_release);
+            return;
+        }
+
+        auto rand = manager_rand();
+        bool success = false;
+        /* same numa node first */
+        int from_node = schedulers[thread_from]->numa_node;
+        bool multi_node = node_schedulers.size() > 1;
+        if (multi_node)
+        {
+            auto & peers = node_schedulers[from_node];
+            size_t start = rand % peers.size();
+            for (size_t i = 0; i < peers.size() && !success; i++)
+                success = stealing_from(thread_from, peers[(start + i) % peers.size()], res);
+        }
+
+        /* random start and coprime stride, visit every victim once */
+        auto count = schedulers.size();
+        size_t idx = rand % count;
+        size_t stride = steal_strides[(rand >> 16) % steal_strides.size()];
+        for (size_t i = 0; i < count && !success; i++, idx = (idx + stride) % count)
+        {
+            /* already visited */
+            if (multi_node && schedulers[idx]->numa_node == from_node)
                 continue;
 
-            schedulers[i]->pull_half_co(res);
+            success = stealing_from(thread_from, idx, res);
         }
 
+        spinning_count.fetch_sub(1, std::memory_order_release);
+
         for (auto co: res)
             co->sched.occupy_thread = thread_from;
     }
 
-    std::vector<Co_t *> SchedManager::stealing_work(int thread_from) {
-        DASSERT(thread_from >= 0 && (size_t) thread_from < schedulers.size());
-#ifdef __STACK_STATIC__
-        return std::vector<Co_t*>{};
-#endif
-
-        std::vector<Co_t *> res{};
-        for (size_t i = 0; i < schedulers.size(); i++) {
-            if ((int) i == thread_from)
-                continue;
+    bool SchedManager::stealing_from(int thread_from, int victim, std::vector<Co_t *> &res) {
+        if (victim == thread_from)
+            return false;
 
-            schedulers[i]->pull_half_co(res);
-        }
-
-        for (auto co: res) {
-            co->sched.occupy_thread = thread_from;
-        }
+        schedulers[victim]->pull_half_co(res);
+        /* stop after the first success */
+        return !res.empty();
+    }
 
+    std::vector<Co_t *> SchedManager::stealing_work(int thread_from) {
+        std::vector<Co_t *> res{};
+        stealing_work(thread_from, res);
         return res;
     }
 
     void SchedManager::add_scheduler(Scheduler *s, int idx) {
         std::lock_guard lock(w_lock);
         schedulers.at(idx) = s;
+        if (node_schedulers.size() <= (size_t) s->numa_node)
+            node_schedulers.resize(s->numa_node + 1);
+        node_schedulers[s->numa_node].push_back(idx);
         scheduler_count++;
 
         /* vector init finish */
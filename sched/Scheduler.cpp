@@ -1,7 +1,10 @@
+#include <array>
 #include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <iterator>
 #include <mutex>
+#include <utility>
 #include <vector>
 
 #include "Scheduler.h"
@@ -13,17 +16,60 @@
 #include "utils.h"
 #include "../timer/include/Timer.h"
 
+#ifdef __SCHED_PREEMPT__
+#include <ucontext.h>
+
+/* program text, async preemption only lands here */
+extern "C" char __executable_start[];
+extern "C" char etext[];
+uint64_t co_xsave_size{};
+
+extern "C" uint64_t co_async_preempt()
+{
+    return co::Scheduler::async_preempt();
+}
+#endif
+
 namespace co {
+#ifdef __SCHED_CFS_GROUP__
+    CfsGroup::CfsGroup(int nice, size_t scheduler_count)
+    {
+        this->nice = nice;
+        entities = std::make_unique<CfsGroupEntity[]>(scheduler_count);
+        for (size_t i = 0; i < scheduler_count; i++)
+            entities[i].group = this;
+    }
+
+    void CfsGroup::release()
+    {
+        if (ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+#endif
+
     void Scheduler::push_to_ready(Co_t * co, bool enable_lock)
     {
         std::unique_lock<spin_lock_t> lock;
         if (enable_lock)
             lock = std::unique_lock(sched_lock);
 
+#ifdef __SCHED_EDF__
+        if (co->sched.deadline_ns != 0)
+            push_to_deadline(co);
+        else
+#endif
+#ifdef __SCHED_CFS_GROUP__
+        if (co->sched.group != nullptr)
+            push_to_group(sort_wrap{co->sched.priority(), co});
+        else
+#endif
         if (co->sched.can_migration)
             ready.push(sort_wrap{co->sched.priority(), co});
         else
             ready_fixed.push(sort_wrap{co->sched.priority(), co});
+#ifdef __SCHED_LOCAL_SLICE__
+        check_slice(co->sched.priority());
+#endif
 
 #ifdef __DEBUG_SCHED__
         co_ctx::removal_lock.lock();
@@ -31,7 +77,31 @@ namespace co {
         co_ctx::removal_lock.unlock();
 #endif
 
-        ready_count++;
+        add_ready_count(1);
+    }
+
+    void Scheduler::add_ready_count(size_t count)
+    {
+#ifdef __SCHED_LOCAL_SLICE__
+        /* owner modify without sched_lock */
+        atomization(ready_count)->fetch_add(count, std::memory_order_relaxed);
+#else
+        ready_count += count;
+#endif
+    }
+
+    void Scheduler::sub_ready_count(size_t count)
+    {
+#ifdef __SCHED_LOCAL_SLICE__
+        atomization(ready_count)->fetch_sub(count, std::memory_order_relaxed);
+#else
+        ready_count -= count;
+#endif
+    }
+
+    bool Scheduler::is_owner() const
+    {
+        return std::this_thread::get_id() == owner_id;
     }
 
     void Scheduler::push_all_to_ready(const std::vector<sort_wrap> & co_vec, const std::vector<sort_wrap> & fixed_co, bool enable_lock)
@@ -40,13 +110,61 @@ namespace co {
         if (enable_lock)
             lock = std::unique_lock(sched_lock);
 
+#if defined(__SCHED_CFS_GROUP__) || defined(__SCHED_EDF__)
+        /* deadline and group coroutines go to their own heap */
+        auto route_fn = [this](const sort_wrap & wrap, QuaternaryHeap<sort_wrap, SortWrapLessCmp> & heap)
+        {
+#ifdef __SCHED_EDF__
+            if (wrap.co->sched.deadline_ns != 0)
+                return push_to_deadline(wrap.co);
+#endif
+#ifdef __SCHED_CFS_GROUP__
+            if (wrap.co->sched.group != nullptr)
+                return push_to_group(wrap);
+#endif
+            heap.push(wrap);
+        };
+        for (auto & wrap : co_vec)
+            route_fn(wrap, ready);
+        for (auto & wrap : fixed_co)
+            route_fn(wrap, ready_fixed);
+#else
         ready.push_all(co_vec.begin(), co_vec.end());
         ready_fixed.push_all(fixed_co.begin(), fixed_co.end());
-        ready_count += co_vec.size() + fixed_co.size();
+#endif
+#ifdef __SCHED_LOCAL_SLICE__
+        for (auto & wrap : co_vec)
+            check_slice(wrap.priority);
+        for (auto & wrap : fixed_co)
+            check_slice(wrap.priority);
+#endif
+        add_ready_count(co_vec.size() + fixed_co.size());
     }
 
     void Scheduler::pull_half_co(std::vector<Co_t*> & ans)
     {
+#ifdef __SCHED_EDF__
+        /* latest deadlines first, then cfs */
+        if (deadline_count.load(std::memory_order_relaxed) > 1)
+        {
+            std::lock_guard lock(sched_lock);
+            pull_half_deadline(ans);
+            if (!ans.empty())
+                return;
+        }
+#endif
+#ifdef __SCHED_CFS_GROUP__
+        if (ready.empty() && ready_group.empty())
+            return;
+
+        std::lock_guard lock(sched_lock);
+        /* double check, root coroutines first, then half of a group */
+        if (ready.empty())
+        {
+            pull_half_group(ans);
+            return;
+        }
+#else
         if (ready.empty())
             return;
 
@@ -54,6 +172,7 @@ namespace co {
         /* double check */
         if (ready.empty())
             return;
+#endif
 
         int trans_size = 0;
         int pull_count = ready.size() / 2;
@@ -69,28 +188,30 @@ namespace co {
             co_ctx::co_vec.erase(ans.back());
             co_ctx::removal_lock.unlock();
 #endif
+            detach_co(ans.back());
             remove_from_scheduler(ans.back());
             ans.back()->sched.occupy_thread = -1;
         }
 
-        ready_count -= trans_size;
+        sub_ready_count(trans_size);
     }
 
-    void Scheduler::pull_from_buffer(std::vector<Co_t*> & ans)
+    void Scheduler::pull_from_inbox(std::vector<Co_t*> & ans)
     {
-        Co_t * cur{};
-        for (int i = 0; i < APPLY_BUFFER_SIZE && buffer.pop(cur); i++)
+        auto cur = inbox.pop_all();
+        while (cur != nullptr)
         {
-            assert(cur != nullptr);
+            auto next = cur->inbox_next;
+            cur->inbox_next = nullptr;
             ans.push_back(cur);
+            cur = next;
         }
     }
 
-    std::vector<Co_t*> Scheduler::pull_from_buffer()
+    std::vector<Co_t*> Scheduler::pull_from_inbox()
     {
         std::vector<Co_t*> ans{};
-        ans.reserve(APPLY_BUFFER_SIZE);
-        pull_from_buffer(ans);
+        pull_from_inbox(ans);
         return ans;
     }
 
@@ -110,21 +231,21 @@ namespace co {
 
     void Scheduler::apply_ready_lazy(Co_t * co)
     {
-        if (UNLIKELY(!buffer.push(co)))
-        {
-            auto cur_sched_lock = std::unique_lock(sched_lock, std::defer_lock);
-            auto buf_co = pull_from_buffer();
-            buf_co.push_back(co);
-            apply_ready_all(buf_co, cur_sched_lock, true);
-        }
+        inbox.push(co);
+#ifdef __SINGLE_THREAD__
+        /* maybe from another thread */
+        sem_ready.signal_remote();
+#else
         sem_ready.signal();
+#endif
     }
 
     void Scheduler::get_ready_to_push(Co_t * co, uint64_t & sum_v_runtime)
     {
 #ifdef __SCHED_CFS__
-        if (co->sched.v_runtime == 0)
-            co->sched.v_runtime = min_v_runtime.load(std::memory_order_relaxed);
+        /* new or taken off a scheduler, v_runtime is on another timeline */
+        if (co->sched.v_runtime == 0 || co->sched.detached)
+            co->sched.place(min_v_runtime.load(std::memory_order_relaxed));
 #endif
 
 #ifdef __DEBUG__
@@ -147,19 +268,19 @@ namespace co {
         co->scheduler = this;
     }
 
-    void Scheduler::apply_ready_eager(Co_t * co, bool from_buffer)
+    void Scheduler::apply_ready_eager(Co_t * co, bool from_inbox)
     {
         uint64_t cur_sum_v_runtime{};
         get_ready_to_push(co, cur_sum_v_runtime);
         push_to_ready(co, true);
-        if (!from_buffer)
+        if (!from_inbox)
             sem_ready.signal();
     }
 
     void Scheduler::apply_ready_all(
             const std::vector<Co_t *> & co_vec,
             std::unique_lock<spin_lock_t> & locker,
-            bool from_buffer,
+            bool from_inbox,
             bool enable_lock,
             bool unlock_exit)
     {
@@ -194,7 +315,7 @@ namespace co {
             push_all_to_ready(unfixed_co, fixed_co, false);
         }
 
-        if (!from_buffer)
+        if (!from_inbox)
             sem_ready.signal(co_vec.size());
     }
 
@@ -203,8 +324,286 @@ namespace co {
         co->scheduler = nullptr;
     }
 
+#ifdef __SCHED_EDF__
+    /* under sched_lock */
+    void Scheduler::push_to_deadline(Co_t * co)
+    {
+        ready_deadline.push(sort_wrap{static_cast<uint64_t>(co->sched.deadline_ns), co});
+        deadline_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* owner only, earliest deadline, nullptr if none, sched_lock is released when found */
+    Co_t * Scheduler::pickup_deadline(std::unique_lock<spin_lock_t> & cur_sched_lock)
+    {
+        if (LIKELY(deadline_count.load(std::memory_order_relaxed) == 0))
+            return nullptr;
+
+        if (!cur_sched_lock.owns_lock())
+            cur_sched_lock.lock();
+        if (ready_deadline.empty())
+            return nullptr;
+
+        auto ans = ready_deadline.top().co;
+        ready_deadline.pop();
+        deadline_count.fetch_sub(1, std::memory_order_relaxed);
+        cur_sched_lock.unlock();
+        DASSERT(ans->status == CO_READY);
+        return ans;
+    }
+
+    /* under sched_lock, half of the latest deadlines, the earliest stay with the owner */
+    void Scheduler::pull_half_deadline(std::vector<Co_t*> & ans)
+    {
+        int trans_size = 0;
+        std::vector<sort_wrap> latest{};
+        ready_deadline.pop_max_n(ready_deadline.size() / 2, std::back_inserter(latest));
+        for (auto & wrap : latest)
+        {
+            if (UNLIKELY(!wrap.co->sched.can_migration) || !sem_ready.try_wait())
+            {
+                ready_deadline.push(wrap);
+                wrap.co = nullptr;
+                continue;
+            }
+
+            ans.push_back(wrap.co);
+            detach_co(wrap.co);
+            remove_from_scheduler(wrap.co);
+            wrap.co->sched.occupy_thread = -1;
+            trans_size++;
+        }
+
+        /* none of them is due before a deadline kept here */
+        int early_size = 0;
+        if (trans_size > 0 && !ready_deadline.empty())
+        {
+            auto kept_latest = ready_deadline.max();
+            for (auto & wrap : latest)
+                early_size += wrap.co != nullptr && SortWrapLessCmp{}(wrap, kept_latest);
+        }
+        deadline_stolen.fetch_add(trans_size, std::memory_order_relaxed);
+        deadline_stolen_early.fetch_add(early_size, std::memory_order_relaxed);
+
+        deadline_count.fetch_sub(trans_size, std::memory_order_relaxed);
+        sub_ready_count(trans_size);
+    }
+
+    /* owner only, the coroutine is dead */
+    void Scheduler::finish_deadline(Co_t * co)
+    {
+        if (co->sched.deadline_ns == 0)
+            return;
+
+        deadline_finished.fetch_add(1, std::memory_order_relaxed);
+        if (co_ctx::clock.rdns() > co->sched.deadline_ns)
+            deadline_missed.fetch_add(1, std::memory_order_relaxed);
+    }
+#endif
+
+#ifdef __SCHED_CFS_GROUP__
+    CfsGroupEntity * Scheduler::group_entity(Co_t * co)
+    {
+        return std::addressof(co->sched.group->entities[this_thread_id]);
+    }
+
+    /* under sched_lock */
+    void Scheduler::push_to_group(const sort_wrap & wrap)
+    {
+        auto entity = group_entity(wrap.co);
+        entity->ready.push(wrap);
+        if (!entity->queued && entity != curr_group)
+            enqueue_group(entity);
+    }
+
+    /* under sched_lock, an idle group is placed at min_v_runtime, it can't catch up with a burst */
+    void Scheduler::enqueue_group(CfsGroupEntity * entity)
+    {
+        auto cur_min = min_v_runtime.load(std::memory_order_relaxed);
+        if (entity->v_runtime < cur_min)
+            entity->v_runtime = cur_min;
+
+        entity->queued = true;
+        ready_group.push(group_wrap{entity->v_runtime, entity});
+    }
+
+    /* under sched_lock, owner only */
+    void Scheduler::update_group_load(CfsGroupEntity * entity)
+    {
+        auto load = static_cast<int64_t>(entity->ready.size()) + (entity == curr_group);
+        if (load != entity->load)
+            entity->group->load.fetch_add(load - std::exchange(entity->load, load), std::memory_order_relaxed);
+    }
+
+    /* under sched_lock, owner only, like update_cfs_group the share is weigh * load / load of the group */
+    void Scheduler::charge_group(CfsGroupEntity * entity)
+    {
+        update_group_load(entity);
+        if (entity->pending_ns == 0)
+            return;
+
+        /* the exec time ran with one coroutine at least */
+        auto load = std::max<int64_t>(entity->load, 1);
+        auto total = std::max(entity->group->load.load(std::memory_order_relaxed), load);
+        uint64_t weigh = nice_to_weigh[entity->group->nice + CfsSchedEntity::nice_offset];
+        auto share = std::max(weigh * load / total, CfsGroup::MIN_SHARE);
+        entity->v_runtime += (std::exchange(entity->pending_ns, 0) << 10) / share;
+    }
+
+    /* under sched_lock, owner only, like put_prev_entity */
+    void Scheduler::put_prev_group()
+    {
+        if (curr_group == nullptr)
+            return;
+
+        auto entity = std::exchange(curr_group, nullptr);
+        charge_group(entity);
+        if (!entity->ready.empty() && !entity->queued)
+            enqueue_group(entity);
+    }
+
+    /* under sched_lock, owner only, nullptr if a root coroutine goes first */
+    Co_t * Scheduler::pickup_from_group()
+    {
+        while (!ready_group.empty())
+        {
+            auto top = ready_group.top();
+            auto key = sort_wrap{top.priority, nullptr};
+            if ((!ready.empty() && !SortWrapLessCmp{}(key, ready.top()))
+                || (!ready_fixed.empty() && !SortWrapLessCmp{}(key, ready_fixed.top())))
+                return nullptr;
+
+            ready_group.pop();
+            auto entity = top.entity;
+            entity->queued = false;
+            if (UNLIKELY(entity->ready.empty()))
+                continue;
+
+            /* exec time of runnext */
+            charge_group(entity);
+            auto ans = entity->ready.top().co;
+            entity->ready.pop();
+            curr_group = entity;
+            return ans;
+        }
+
+        return nullptr;
+    }
+
+    /* under sched_lock, half of the last group in ready_group */
+    void Scheduler::pull_half_group(std::vector<Co_t*> & ans)
+    {
+        if (ready_group.empty())
+            return;
+
+        auto entity = ready_group.pop_back().entity;
+        entity->queued = false;
+        int trans_size = 0;
+        int pull_count = entity->ready.size() / 2;
+        for (; trans_size < pull_count; trans_size++)
+        {
+            if (!sem_ready.try_wait())
+                break;
+
+            auto wrap = entity->ready.pop_back();
+            if (UNLIKELY(!wrap.co->sched.can_migration))
+            {
+                entity->ready.push(wrap);
+                sem_ready.signal();
+                break;
+            }
+
+            ans.push_back(wrap.co);
+            detach_co(wrap.co);
+            remove_from_scheduler(wrap.co);
+            wrap.co->sched.occupy_thread = -1;
+        }
+
+        sub_ready_count(trans_size);
+        update_group_load(entity);
+        if (!entity->ready.empty())
+            enqueue_group(entity);
+    }
+
+    /* owner only, the last reference may go with this coroutine */
+    void Scheduler::release_group(Co_t * co)
+    {
+        auto group = std::exchange(co->sched.group, nullptr);
+        if (group == nullptr)
+            return;
+
+        if (curr_group != nullptr && curr_group->group == group)
+        {
+            std::lock_guard lock(sched_lock);
+            put_prev_group();
+        }
+        group->release();
+    }
+#endif
+
+    /* under sched_lock, like update_min_vruntime, never goes back */
+    void Scheduler::up_min_v_runtime(uint64_t curr_v_runtime)
+    {
+        auto cur_min = curr_v_runtime;
+        if (!ready.empty())
+            cur_min = std::min(cur_min, ready.top().priority);
+        if (!ready_fixed.empty())
+            cur_min = std::min(cur_min, ready_fixed.top().priority);
+#ifdef __SCHED_CFS_GROUP__
+        if (!ready_group.empty())
+            cur_min = std::min(cur_min, ready_group.top().priority);
+#endif
+
+        if (cur_min > min_v_runtime.load(std::memory_order_relaxed))
+            min_v_runtime.store(cur_min, std::memory_order_relaxed);
+    }
+
+    /* v_runtime is kept as the lag to min_v_runtime of this scheduler */
+    void Scheduler::detach_co(Co_t * co)
+    {
+        co->sched.detach(min_v_runtime.load(std::memory_order_relaxed), co->wakeup_reason == CO_WAKEUP_TIMER);
+    }
+
+    /* owner only, until a ready token is taken */
+    void Scheduler::park()
+    {
+#if defined(__STACK_DYN__) && !defined(__MEM_PMR__)
+        /* stacks freed by other workers go back before the sleep, not at an alloc_stk far later */
+        if (stk_pool->remote_free.load(std::memory_order_relaxed) != nullptr)
+            stk_pool->drain_remote_free();
+#endif
+        co_ctx::manager->set_idle(this_thread_id, true);
+#ifdef __SINGLE_THREAD__
+        /* no tick thread, an expired timer may make a coroutine ready */
+        while (!sem_ready.wait_for(Timer::TickInterval))
+            tick();
+#else
+        sem_ready.wait();
+#endif
+        co_ctx::manager->set_idle(this_thread_id, false);
+    }
+
+#ifdef __SINGLE_THREAD__
+    /* owner only, in place of the tick thread */
+    void Scheduler::tick()
+    {
+        auto now = co_ctx::clock.rdns();
+        if (now < next_tick_ns)
+            return;
+
+        next_tick_ns = now + std::chrono::duration_cast<std::chrono::nanoseconds>(Timer::TickInterval).count();
+        co_ctx::loc->timer->tick();
+    }
+#endif
+
     Co_t * Scheduler::pickup_ready()
     {
+#ifdef __SINGLE_THREAD__
+        tick();
+#endif
+        if (auto co = take_runnext(); co != nullptr)
+            return co;
+
+        runnext_streak = 0;
         std::unique_lock cur_sched_lock = std::unique_lock(sched_lock, std::defer_lock);
         if (!sem_ready.try_wait())
         {
@@ -215,86 +614,88 @@ namespace co {
                 if (cur_sched_lock.owns_lock())
                     cur_sched_lock.unlock();
 
-                sem_ready.wait();
-            } else {
-                goto end_pull_from_buffer;
+                park();
             }
         }
 
-        /* pull coroutines from buffer */
+        /* pull all coroutines from inbox in one exchange */
+        /* also after stealing, the token may be of a coroutine in the inbox */
+        /* every signal follows its publish (inbox push or cfs heap under sched_lock), a held token is visible here */
         {
-            if (atomization(ready_count)->load(std::memory_order_relaxed) == 0)
-            {
-                cur_sched_lock.lock();
-                if (ready_count > 0)
-                    goto end_pull_from_buffer;
-                else
-                    cur_sched_lock.unlock();
-            }
-
             std::vector<Co_t*> res{};
-            while (atomization(ready_count)->load(std::memory_order_relaxed) == 0)
-            {
-                pull_from_buffer(res);
-                if (res.empty())
-                    continue;
+            if (!inbox.empty())
+                pull_from_inbox(res);
 
-                apply_ready_all(res, cur_sched_lock, true, true, false);
-                break;
-            }
+            DASSERT(!res.empty() || atomization(ready_count)->load(std::memory_order_relaxed) > 0);
+            if (!res.empty())
+                apply_ready_all(res, cur_sched_lock, true, !cur_sched_lock.owns_lock(), false);
         }
 
-        /* label: end_pull_from_buffer */
-        end_pull_from_buffer:
+#ifdef __SCHED_EDF__
+        if (auto co = pickup_deadline(cur_sched_lock); co != nullptr)
+        {
+            sub_ready_count(1);
+            return co;
+        }
+#endif
 #ifdef __DEBUG__
         if (!cur_sched_lock.owns_lock())
             cur_sched_lock.lock();
 
+#ifdef __SCHED_LOCAL_SLICE__
+        DASSERT(!(ready.empty() && ready_fixed.empty() && slice_head == slice_size));
+#elif defined(__SCHED_CFS_GROUP__)
+        DASSERT(!(ready.empty() && ready_fixed.empty() && ready_group.empty()
+                  && (curr_group == nullptr || curr_group->ready.empty())));
+#else
         DASSERT(!(ready.empty() && ready_fixed.empty()));
 #endif
+#endif
 
 #ifdef __SCHED_CFS__
+#ifdef __SCHED_LOCAL_SLICE__
+        auto ans = pickup_from_slice(cur_sched_lock);
+        sub_ready_count(1);
+#else
         if (!cur_sched_lock.owns_lock())
             cur_sched_lock.lock();
 
-        ready_count--;
+        sub_ready_count(1);
 
         Co_t * ans{};
-        Co_t * ans_list[2]{nullptr, nullptr};
-        if (!ready.empty())
-            ans_list[0] = ready.top().co;
-        if (!ready_fixed.empty())
-            ans_list[1] = ready_fixed.top().co;
-
-        assert(UNLIKELY(ans_list[0] || ans_list[1]));
-
-        if (CoPtrLessCmp{}(ans_list[0], ans_list[1]))
-        {
-            ans = ans_list[0];
-            ready.pop();
-        } else {
-            ans = ans_list[1];
-            ready_fixed.pop();
-        }
-
-        auto up_v_runtime_fn = [this](uint64_t cur_v_time) -> uint64_t
+#ifdef __SCHED_CFS_GROUP__
+        put_prev_group();
+        ans = pickup_from_group();
+#endif
+        if (ans == nullptr)
         {
+            Co_t * ans_list[2]{nullptr, nullptr};
             if (!ready.empty())
-            {
-                auto top_v_time = ready.top().priority;
-                cur_v_time = cur_v_time > 0 ? std::min(cur_v_time, top_v_time) : top_v_time;
-            }
+                ans_list[0] = ready.top().co;
             if (!ready_fixed.empty())
+                ans_list[1] = ready_fixed.top().co;
+
+            assert(UNLIKELY(ans_list[0] || ans_list[1]));
+
+            if (CoPtrLessCmp{}(ans_list[0], ans_list[1]))
             {
-                auto top_v_time = ready_fixed.top().priority;
-                cur_v_time = cur_v_time > 0 ? std::min(cur_v_time, top_v_time) : top_v_time;
+                ans = ans_list[0];
+                ready.pop();
+            } else {
+                ans = ans_list[1];
+                ready_fixed.pop();
             }
+        }
 
-            return cur_v_time;
-        };
-        atomic_fetch_modify(min_v_runtime, up_v_runtime_fn, std::memory_order_acq_rel);
+#ifdef __SCHED_CFS_GROUP__
+        /* a group member is on the timeline of its group */
+        up_min_v_runtime(curr_group != nullptr ? curr_group->v_runtime : ans->sched.priority());
+#else
+        up_min_v_runtime(ans->sched.priority());
+#endif
 
         cur_sched_lock.unlock();
+#endif
 #else
         static_assert(false);
 #endif
@@ -308,7 +709,94 @@ namespace co {
         return ans;
     }
 
+#ifdef __SCHED_LOCAL_SLICE__
+    /* under sched_lock, a coroutine should run before the local slice */
+    void Scheduler::check_slice(uint64_t priority)
+    {
+        if (priority <= slice_limit.load(std::memory_order_relaxed))
+            slice_dirty.store(true, std::memory_order_relaxed);
+    }
+
+    /* owner only, pop the lowest v_runtime coroutines to local slice in batch */
+    /* sched_lock and min_v_runtime update are amortized over the batch */
+    Co_t * Scheduler::pickup_from_slice(std::unique_lock<spin_lock_t> & cur_sched_lock)
+    {
+        if (slice_head < slice_size && !slice_dirty.load(std::memory_order_relaxed)
+            && co_ctx::clock.rdns() - slice_timestamp <= SLICE_MAX_AGE)
+        {
+            if (cur_sched_lock.owns_lock())
+                cur_sched_lock.unlock();
+
+            return slice[slice_head++];
+        }
+
+        if (!cur_sched_lock.owns_lock())
+            cur_sched_lock.lock();
+
+        /* stale or dirty, give back to cfs heap, still counted in ready_count */
+        /* batch shrinks when the slice is dirty or not used up */
+        /* grows after SLICE_GROW_STREAK slices used up in a row */
+        if (slice_dirty.load(std::memory_order_relaxed) || slice_head < slice_size)
+        {
+            slice_batch = std::max<size_t>(slice_batch / 2, 1);
+            slice_clean_streak = 0;
+        } else if (slice_size == slice_batch && ++slice_clean_streak >= SLICE_GROW_STREAK) {
+            slice_batch = std::min<size_t>(slice_batch * 2, SLICE_SIZE);
+            slice_clean_streak = 0;
+        }
+
+        for (; slice_head < slice_size; slice_head++)
+        {
+            auto co = slice[slice_head];
+            if (co->sched.can_migration)
+                ready.push(sort_wrap{co->sched.priority(), co});
+            else
+                ready_fixed.push(sort_wrap{co->sched.priority(), co});
+        }
+
+        /* deeper queue, bigger batch, keep the rest for thieves */
+        auto depth = static_cast<size_t>(ready.size() + ready_fixed.size());
+        auto batch = std::clamp<size_t>(depth / SLICE_DEPTH_RATIO, 1, slice_batch);
+        slice_head = slice_size = 0;
+        for (; slice_size < batch; slice_size++)
+        {
+            Co_t * ans_list[2]{nullptr, nullptr};
+            if (!ready.empty())
+                ans_list[0] = ready.top().co;
+            if (!ready_fixed.empty())
+                ans_list[1] = ready_fixed.top().co;
+
+            if (ans_list[0] == nullptr && ans_list[1] == nullptr)
+                break;
+
+            if (CoPtrLessCmp{}(ans_list[0], ans_list[1]))
+            {
+                slice[slice_size] = ans_list[0];
+                ready.pop();
+            } else {
+                slice[slice_size] = ans_list[1];
+                ready_fixed.pop();
+            }
+        }
+        assert(UNLIKELY(slice_size > 0));
+        slice_limit.store(slice[slice_size - 1]->sched.priority(), std::memory_order_relaxed);
+        slice_dirty.store(false, std::memory_order_relaxed);
+
+        up_min_v_runtime(slice[0]->sched.priority());
+
+        cur_sched_lock.unlock();
+        slice_timestamp = co_ctx::clock.rdns();
+        return slice[slice_head++];
+    }
+#endif
+
     void Scheduler::run(Co_t * co)
+    {
+        prepare_run(co);
+        latest_arg = swap_context(&sched_ctx, &co->ctx);
+    }
+
+    void Scheduler::prepare_run(Co_t * co)
     {
         assert(UNLIKELY(co->status == CO_READY));
 
@@ -318,17 +806,25 @@ namespace co {
         {
 #ifdef __STACK_STATIC__
             /* 设置stack分配器 */
-            if (UNLIKELY(co->co_ctx.static_stk_pool == nullptr))
-                co->co_ctx.static_stk_pool = &co_ctx::loc->alloc.stk_pool;
+            if (UNLIKELY(co->ctx.static_stk_pool == nullptr))
+            {
+                /* frames hold addresses of the shared stack of this worker from now on */
+                co->ctx.static_stk_pool = &co_ctx::loc->alloc.stk_pool;
+                co->sched.can_migration = false;
+                co->sched.occupy_thread = this_thread_id;
+            }
 
             /* 分配堆栈 */
-            co->co_ctx.static_stk_pool->alloc_static_stk(co);
-            if (UNLIKELY(co->co_ctx.first_full_save))
-                make_context_wrap(&co->co_ctx, &co::wrap);
+            co->ctx.static_stk_pool->alloc_static_stk(co);
+            if (UNLIKELY(co->ctx.first_full_save))
+                make_context_wrap(&co->ctx, &co::wrap);
 #elif __STACK_DYN__
             if (UNLIKELY(co->ctx.stk_dyn_alloc == nullptr))
             {
                 co_ctx::loc->alloc.dyn_stk_pool.alloc_stk(&co->ctx);
+#ifdef __STACK_DYN_RECLAIM__
+                co_ctx::loc->alloc.dyn_stk_pool.track(co);
+#endif
                 make_context_wrap(&co->ctx, &co::wrap);
             }
 #endif
@@ -343,9 +839,137 @@ namespace co {
         running_co = co;
         co->status = CO_RUNNING;
         co->sched.start_exec();
-        latest_arg = swap_context(&sched_ctx, &co->ctx);
+        auto now_tsc = TSCNS::rdtsc();
+        slice_deadline = now_tsc + co_ctx::time_slice_tsc[co->sched.nice + CfsSchedEntity::nice_offset];
+#ifdef __SCHED_PREEMPT__
+        /* main coroutine runs on the thread stack, never preempted */
+        preempt_start_tsc.store(co->is_main_co ? 0 : now_tsc, std::memory_order_relaxed);
+#endif
+    }
+
+    /* approximate, owner only */
+    bool Scheduler::has_ready()
+    {
+        return runnext != nullptr
+               || !inbox.empty()
+               || atomization(ready_count)->load(std::memory_order_relaxed) > 0;
     }
 
+    /* co is woken by the running coroutine of this scheduler, run it next */
+    /* the previous one in the slot goes to the cfs heap */
+    bool Scheduler::try_runnext(Co_t * co)
+    {
+        PreemptGuard guard{};
+        if (!is_owner() || running_co == nullptr || co->sched.occupy_thread != this_thread_id)
+            return false;
+
+        uint64_t cur_sum_v_runtime{};
+        get_ready_to_push(co, cur_sum_v_runtime);
+        auto prev = std::exchange(runnext, co);
+        if (prev != nullptr)
+            apply_ready_eager(prev);
+
+        return true;
+    }
+
+    /* runnext is taken at most RUNNEXT_MAX_STREAK times in a row */
+    Co_t * Scheduler::take_runnext()
+    {
+        if (LIKELY(runnext == nullptr))
+            return nullptr;
+
+        auto co = std::exchange(runnext, nullptr);
+        if (runnext_streak < RUNNEXT_MAX_STREAK)
+        {
+            runnext_streak++;
+            return co;
+        }
+
+        /* let the cfs heap go first */
+        apply_ready_eager(co);
+        return nullptr;
+    }
+
+#ifdef __SCHED_HANDOFF__
+    /* exec end of the coroutine switched out by handoff, run on the next coroutine */
+    void Scheduler::finish_handoff()
+    {
+        if (LIKELY(handoff_prev == nullptr))
+            return;
+
+        auto prev = handoff_prev;
+        handoff_prev = nullptr;
+        process_co_exec_end(prev);
+    }
+#endif
+
+#if defined(__SCHED_HANDOFF__) || defined(__SCHED_PREEMPT__)
+    /* thread local may be cached across swap_context, reload it after resume */
+    __attribute__((noinline)) Scheduler * Scheduler::current()
+    {
+        return co_ctx::loc->scheduler;
+    }
+#endif
+
+    /* running coroutine of this thread, not torn by a preemption between the two loads */
+    Co_t * Scheduler::current_co()
+    {
+        PreemptGuard guard{};
+        return co_ctx::loc->scheduler->running_co;
+    }
+
+#ifdef __SCHED_PREEMPT__
+    /* timer tick thread of this scheduler, signal the owner if running_co is over its time */
+    void Scheduler::check_preempt()
+    {
+        auto start = preempt_start_tsc.load(std::memory_order_relaxed);
+        auto now = TSCNS::rdtsc();
+        if (start == 0 || co_ctx::preempt_tsc == 0 || now < start || now - start < co_ctx::preempt_tsc)
+            return;
+
+        pthread_kill(owner_thread, SIGURG);
+    }
+
+    /* owner thread, redirect running_co to co_async_preempt_entry when it returns from signal */
+    /* not a coroutine stack, in a non preemptible region or out of the program text (libc, vdso): */
+    /* deferred, signaled again on the next tick */
+    void Scheduler::preempt_handler(int, siginfo_t *, void * uc_ptr)
+    {
+        auto loc = co_ctx::loc.get();
+        if (UNLIKELY(loc == nullptr || loc->scheduler == nullptr || preempt_off > 0))
+            return;
+
+        auto co = loc->scheduler->running_co;
+        if (co == nullptr || co->status.load(std::memory_order_relaxed) != CO_RUNNING)
+            return;
+
+        auto uc = static_cast<ucontext_t *>(uc_ptr);
+        auto sp = static_cast<uint64_t>(uc->uc_mcontext.gregs[REG_RSP]);
+        auto pc = static_cast<uint64_t>(uc->uc_mcontext.gregs[REG_RIP]);
+        auto stk_low = reinterpret_cast<uint64_t>(co->ctx.stk_dyn_mem);
+        auto stk_high = reinterpret_cast<uint64_t>(co->ctx.stk_dyn);
+        if (stk_low == 0 || sp < stk_low + PREEMPT_STACK_RESERVE || sp > stk_high)
+            return;
+
+        if (pc < reinterpret_cast<uint64_t>(__executable_start) || pc >= reinterpret_cast<uint64_t>(etext))
+            return;
+
+        co->preempt_pc = pc;
+        uc->uc_mcontext.gregs[REG_RSP] = static_cast<greg_t>(sp - 128);
+        uc->uc_mcontext.gregs[REG_RIP] = reinterpret_cast<greg_t>(co_async_preempt_entry);
+        /* until it is switched out */
+        preempt_disable();
+    }
+
+    /* on the coroutine stack, called by co_async_preempt_entry, return the interrupted rip */
+    uint64_t Scheduler::async_preempt()
+    {
+        auto pc = current()->running_co->preempt_pc;
+        current()->jump_to_sched(CALL_YIELD);
+        return pc;
+    }
+#endif
+
     /* Coroutine 中断执行 */
     Co_t * Scheduler::interrupt(int new_status, bool unlock_exit)
     {
@@ -357,6 +981,13 @@ namespace co {
 #ifdef __SCHED_CFS__
         /* update running time */
         running_co->sched.up_v_runtime();
+#ifdef __SCHED_CFS_GROUP__
+        /* this exec, charged to group v_runtime on the next pickup */
+        if (running_co->sched.group != nullptr)
+            group_entity(running_co)->pending_ns += running_co->sched.last_exec_ns;
+#endif
+        /* may be applied to another scheduler before exec end */
+        detach_co(running_co);
 #endif
         /* whether unlock when exit */
         if (unlock_exit)
@@ -409,18 +1040,27 @@ namespace co {
 
         /* wakeup waiting coroutine */
         co_ctx::manager->wakeup_await_co_all(dead_co);
+#ifdef __SCHED_CFS_GROUP__
+        release_group(dead_co);
+#endif
+#ifdef __SCHED_EDF__
+        finish_deadline(dead_co);
+#endif
 
         /* 释放栈空间 */
 #ifdef __STACK_DYN__
         if (LIKELY(dead_co->ctx.stk_dyn_mem != nullptr))
         {
             auto stk_pool = dead_co->ctx.stk_dyn_alloc;
+#ifdef __STACK_DYN_RECLAIM__
+            stk_pool->untrack(dead_co);
+#endif
             stk_pool->free_stk(&dead_co->ctx);
         }
 #elif __STACK_STATIC__
-        if (!dead_co->is_main_co) [[likely]]
+        if (LIKELY(dead_co->ctx.static_stk_pool != nullptr))
         {
-            auto stk_pool = dead_co->co_ctx.static_stk_pool;
+            auto stk_pool = dead_co->ctx.static_stk_pool;
             stk_pool->destroy_stack(dead_co);
         }
 #endif
@@ -486,13 +1126,15 @@ namespace co {
     void Scheduler::process_co_exec_end(Co_t * co)
     {
 #ifdef __STACK_STATIC__
-        co->co_ctx.set_stk_size();
-
-            /* release static stack */
-            if (LIKELY(co->co_ctx.static_stk_pool != nullptr))
-                co->co_ctx.static_stk_pool->release_stack(co);
+        /* release static stack */
+        if (LIKELY(co->ctx.static_stk_pool != nullptr))
+            co->ctx.static_stk_pool->release_stack(co);
 #else
         co->ctx.set_stk_dyn_size();
+#ifdef __STACK_DYN_RECLAIM__
+        co->ctx.stk_dyn_park_us = co_ctx::clock.rdus();
+        co->ctx.stk_dyn_reclaimed = false;
+#endif
 #endif
 #ifdef __DEBUG_SCHED_RUN__
         co_ctx::removal_lock.lock();
@@ -528,17 +1170,43 @@ namespace co {
 
             auto co = pickup_ready();
             run(co);
-            process_co_exec_end(co);
+#ifdef __SCHED_PREEMPT__
+            preempt_start_tsc.store(0, std::memory_order_relaxed);
+#endif
+            /* the coroutine back to scheduler may differ from co after handoff */
+            process_co_exec_end(running_co);
         }
     }
 
     void Scheduler::jump_to_sched(int arg)
     {
+        /* re-enabled when switched in again */
+        preempt_disable();
         auto running = running_co;
 
+#ifdef __SCHED_HANDOFF__
+        /* blocked and already interrupted, switch to runnext without scheduler context */
+        Co_t * next{};
+        if (arg == CONTEXT_RESTORE && running != nullptr && (next = take_runnext()) != nullptr)
+        {
+            handoff_prev = running;
+            prepare_run(next);
+            swap_context(&running->ctx, &next->ctx, arg);
+            /* may be resumed by another scheduler */
+            current()->finish_handoff();
+            preempt_reset();
+            return;
+        }
+#endif
+
         if (LIKELY(running != nullptr))
             swap_context(&running->ctx, &sched_ctx, arg);
         else
             swap_context(nullptr, &sched_ctx, arg);
+
+#ifdef __SCHED_HANDOFF__
+        current()->finish_handoff();
+#endif
+        preempt_reset();
     }
 }
\ No newline at end of file
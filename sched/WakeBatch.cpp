@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include "include/WakeBatch.h"
+#include "include/Scheduler.h"
+#include "../include/CoCtx.h"
+
+namespace co {
+    static thread_local WakeBatch * cur_batch{};
+
+    WakeBatch::WakeBatch()
+    {
+        prev = std::exchange(cur_batch, this);
+    }
+
+    WakeBatch::~WakeBatch()
+    {
+        flush();
+        cur_batch = prev;
+    }
+
+    WakeBatch * WakeBatch::current()
+    {
+        return cur_batch;
+    }
+
+    void WakeBatch::add(Co_t * co)
+    {
+        if (UNLIKELY(co->status == CO_RUNNING))
+            throw ApplyRunningCoException();
+
+        wakeups.emplace_back(co_ctx::manager->wake_target(co), co);
+    }
+
+    void WakeBatch::flush()
+    {
+        if (wakeups.empty())
+            return;
+
+        auto & schedulers = co_ctx::manager->schedulers;
+        if (wakeups.size() == 1)
+        {
+            auto [idx, co] = wakeups.front();
+            wakeups.clear();
+            schedulers[idx]->batch_flushes.fetch_add(1, std::memory_order_relaxed);
+            schedulers[idx]->batch_wakeups.fetch_add(1, std::memory_order_relaxed);
+            schedulers[idx]->apply_ready(co);
+            return;
+        }
+
+        std::stable_sort(wakeups.begin(), wakeups.end(), [](const auto & a, const auto & b) { return a.first < b.first; });
+        std::vector<Co_t *> part{};
+        part.reserve(wakeups.size());
+        for (size_t i = 0; i < wakeups.size();)
+        {
+            auto idx = wakeups[i].first;
+            part.clear();
+            for (; i < wakeups.size() && wakeups[i].first == idx; i++)
+                part.push_back(wakeups[i].second);
+
+            auto scheduler = schedulers[idx];
+            scheduler->batch_flushes.fetch_add(1, std::memory_order_relaxed);
+            scheduler->batch_wakeups.fetch_add(part.size(), std::memory_order_relaxed);
+            auto cur_sched_lock = std::unique_lock(scheduler->sched_lock, std::defer_lock);
+            scheduler->apply_ready_all(part, cur_sched_lock);
+        }
+        wakeups.clear();
+    }
+}
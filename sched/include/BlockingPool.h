@@ -0,0 +1,53 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+
+#include "../../include/CoPrivate.h"
+#include "../../utils/include/Invoker.h"
+
+namespace co {
+    /* lives on the stack of the waiting coroutine until it is applied again */
+    struct BlockingTask
+    {
+        InvokerBase * invoker{};
+        Co_t * co{};
+        std::exception_ptr exception{};
+        BlockingTask * next{};
+    };
+
+    /* elastic os threads for blocking calls, out of the schedulers */
+    /* a thread is started when tasks outnumber idle threads, up to max_threads */
+    /* and retired after idle_timeout without a task */
+    class BlockingPool
+    {
+    private:
+        std::mutex m_lock{};
+        std::condition_variable m_cond{};
+        /* fifo of tasks, linked by BlockingTask::next */
+        BlockingTask * head{};
+        BlockingTask * tail{};
+        uint32_t queued{};
+        uint32_t thread_count{};
+        uint32_t idle_count{};
+
+        uint32_t max_threads{};
+        std::chrono::milliseconds idle_timeout{};
+
+        void worker();
+
+        BlockingTask * pop_task(std::unique_lock<std::mutex> &);
+
+        static void run_task(BlockingTask * task);
+    public:
+        BlockingPool(uint32_t max_threads, std::chrono::milliseconds idle_timeout);
+        BlockingPool(const BlockingPool &) = delete;
+
+        void submit(BlockingTask * task);
+
+        [[nodiscard]] uint32_t threads();
+    };
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+
 #include "../../include/CoCtx.h"
 #include "SchedEntity.h"
 
@@ -22,19 +24,37 @@ namespace co {
         constexpr static int nice_offset = 20;
         /* ~128us */
         constexpr static int precision = 17;
+        /* ~4ms, lag kept across schedulers */
+        constexpr static int64_t max_lag = 1 << 22;
 
         int nice{}, prev_nice{};
         uint64_t v_runtime{};
+        /* offset on the timeline of the current scheduler, rebased on migration */
+        int64_t base_v_runtime{};
+        /* v_runtime - min_v_runtime when taken off a scheduler */
+        int64_t lag_v_runtime{};
+        /* taken off a scheduler, placed by lag_v_runtime on the next one */
+        bool detached{};
         uint64_t real_runtime{};
         uint64_t real_runtime_ns{};
         uint64_t start_exec_timestamp{};
         uint64_t end_exec_timestamp{};
+        /* ns of the latest exec, charged to group */
+        uint64_t last_exec_ns{};
+        /* task group, nullptr: root */
+        CfsGroup * group{};
+        /* steady_clock ns, 0: cfs class, otherwise earliest deadline first */
+        int64_t deadline_ns{};
 
         [[nodiscard]] uint64_t priority() const { return v_runtime; }
 
         void up_real_runtime()
         {
-            real_runtime_ns += end_exec_timestamp - start_exec_timestamp;
+            /* rdns may step back on calibration, don't let it wrap */
+            last_exec_ns = 0;
+            if (LIKELY(end_exec_timestamp > start_exec_timestamp))
+                last_exec_ns = end_exec_timestamp - start_exec_timestamp;
+            real_runtime_ns += last_exec_ns;
             real_runtime = (real_runtime_ns >> precision) << precision;
             end_exec_timestamp = start_exec_timestamp = 0;
         }
@@ -55,24 +75,47 @@ namespace co {
 
         void prefetch() const { __builtin_prefetch(std::addressof(v_runtime), 0, 3); }
 
+        [[nodiscard]] uint64_t weighted_runtime(int cur_nice) const
+        {
+            return (real_runtime << 10) / nice_to_weigh[cur_nice + nice_offset];
+        }
+
         void up_nice(int cur_nice)
         {
             assert(cur_nice + nice_offset >= 0 && cur_nice + nice_offset < 40);
-            v_runtime = (real_runtime << 10) / nice_to_weigh[cur_nice + nice_offset];
+            v_runtime = base_v_runtime + weighted_runtime(cur_nice);
             prev_nice = nice;
             nice = cur_nice;
         }
 
         void back_nice()
         {
-            v_runtime = (real_runtime << 10) / nice_to_weigh[prev_nice + nice_offset];
+            v_runtime = base_v_runtime + weighted_runtime(prev_nice);
             std::swap(nice, prev_nice);
         }
 
         void up_v_runtime()
         {
             up_real_runtime();
-            v_runtime = (real_runtime << 10) / nice_to_weigh[nice + nice_offset];
+            v_runtime = base_v_runtime + weighted_runtime(nice);
+        }
+
+        /* relative to min_v_runtime of the scheduler it leaves, boosted: nice is raised until exec end */
+        void detach(uint64_t src_min_v_runtime, bool boosted)
+        {
+            auto cur_v_runtime = boosted ? base_v_runtime + weighted_runtime(prev_nice) : v_runtime;
+            lag_v_runtime = std::clamp<int64_t>((int64_t) (cur_v_runtime - src_min_v_runtime), -max_lag, max_lag);
+            detached = true;
+        }
+
+        /* like place_entity, a new one starts at min_v_runtime, otherwise it keeps its lag */
+        void place(uint64_t dst_min_v_runtime)
+        {
+            auto lag = detached ? lag_v_runtime : 0;
+            auto target = std::max<int64_t>((int64_t) dst_min_v_runtime + lag, 0);
+            base_v_runtime = target - weighted_runtime(nice);
+            v_runtime = target;
+            detached = false;
         }
     };
 
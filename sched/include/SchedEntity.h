@@ -10,14 +10,14 @@ namespace co {
     public:
         bool can_migration{true};
         int occupy_thread{-1};
+#ifdef __SCHED_WAKE_AFFINE__
+        /* steady_clock ns of the latest wake affine migration */
+        uint64_t wake_affine_ns{};
+#endif
 
         virtual ~SchedEntity() = default;
 
-        SchedEntity() {
-#ifdef __STACK_STATIC__
-            can_migration = false;
-#endif
-        }
+        SchedEntity() = default;
 
         virtual void start_exec() {}
 
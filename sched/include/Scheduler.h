@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <array>
 #include <cstdint>
+#include <memory>
 #include <mutex>
 #include <cstddef>
 #include <vector>
@@ -14,6 +16,7 @@
 #include "spin_lock.h"
 #include "../../utils/include/spin_lock_sleep.h"
 #include "../../utils/include/sem_utils.h"
+#include "../../utils/include/single_thread.h"
 #include "../../include/CoPrivate.h"
 #include "../../data_structure/include/QuaternaryHeap.h"
 #include "../../data_structure/include/BinaryHeap.h"
@@ -22,6 +25,26 @@
 #include "../../allocator/include/MemPoolAllocator.h"
 #endif
 #include "../../data_structure/include/RingQueue.h"
+#include "../../data_structure/include/BitSetLockFree.h"
+#include "../../data_structure/include/InboxLockFree.h"
+#ifdef __SCHED_PREEMPT__
+#include <csignal>
+#include <pthread.h>
+
+/* context/async_preempt.S */
+extern "C" void co_async_preempt_entry();
+/* bytes of xsave area for co_async_preempt_entry */
+extern "C" uint64_t co_xsave_size;
+#endif
+#if defined(__SCHED_CFS_GROUP__) && defined(__SCHED_LOCAL_SLICE__)
+#error "__SCHED_CFS_GROUP__ picks from group heaps, not with __SCHED_LOCAL_SLICE__"
+#endif
+#if defined(__SINGLE_THREAD__) && defined(__SCHED_PREEMPT__)
+#error "__SINGLE_THREAD__ has no tick thread, not with __SCHED_PREEMPT__"
+#endif
+#if defined(__STACK_STATIC__) && (defined(__STACK_DYN__) || defined(__SCHED_HANDOFF__) || defined(__SCHED_PREEMPT__))
+#error "__STACK_STATIC__ copies frames at switch time, not with __STACK_DYN__, __SCHED_HANDOFF__ or __SCHED_PREEMPT__"
+#endif
 
 namespace co {
     class ApplyRunningCoException : public std::exception
@@ -55,15 +78,60 @@ namespace co {
 
     struct SortWrapLessCmp
     {
-        bool operator() (const sort_wrap & a, const sort_wrap & b) const
+        /* sort_wrap or group_wrap */
+        template<typename Wrap>
+        bool operator() (const Wrap & a, const Wrap & b) const
         {
             /* a.priority - b.priority */
             /* a.priority & b.priority < 2^63 */
-            return (((a.priority - b.priority) >> (sizeof(uint64_t) - 1)) & 1);
+            return (((a.priority - b.priority) >> (sizeof(uint64_t) * 8 - 1)) & 1);
         }
     };
 #endif
 
+#ifdef __SCHED_CFS_GROUP__
+    /* task group on one scheduler, like cfs_rq of task_group in linux */
+    struct CfsGroupEntity
+    {
+        CfsGroup * group{};
+        QuaternaryHeap<sort_wrap, SortWrapLessCmp> ready{};
+        /* v_runtime += exec time * weigh(0) / share of the group on this scheduler */
+        uint64_t v_runtime{};
+        /* owner only, exec time not yet charged to v_runtime */
+        uint64_t pending_ns{};
+        /* coroutines of the group queued or running here, as added to CfsGroup::load */
+        int64_t load{};
+        /* in Scheduler::ready_group */
+        bool queued{};
+    };
+
+    struct group_wrap
+    {
+        uint64_t priority{};
+        CfsGroupEntity * entity{};
+    };
+
+    /* one entity per scheduler, freed by the last reference */
+    /* SchedGroup handle and every coroutine alive in the group hold a reference */
+    struct CfsGroup
+    {
+        /* like MIN_SHARES, the share of an entity with little load */
+        constexpr static uint64_t MIN_SHARE = 2;
+
+        int nice{};
+        std::atomic<int64_t> ref_count{1};
+        /* load of all entities, the weigh of the group is split across schedulers by it */
+        std::atomic<int64_t> load{};
+        std::unique_ptr<CfsGroupEntity[]> entities{};
+
+        CfsGroup(int nice, size_t scheduler_count);
+
+        void acquire() { ref_count.fetch_add(1, std::memory_order_relaxed); }
+
+        void release();
+    };
+#endif
+
     enum {
         APPLY_EAGER = 1,
         APPLY_LAZY,
@@ -74,25 +142,94 @@ namespace co {
     {
     public:
         int this_thread_id{};
+        int numa_node{};
+#ifdef __STACK_DYN__
+        /* dyn stack pool of the worker, walked by reclaim_stacks and stack_cache_stats */
+        DynStackPool * stk_pool{};
+#endif
         //std::atomic<uint64_t> sum_v_runtime{};
         size_t ready_count{};
-        counting_semaphore sem_ready{};
+#ifdef __SINGLE_THREAD__
+        worker_semaphore sem_ready{};
+        /* co_ctx::clock ns, the timer is ticked by the scheduler after it */
+        int64_t next_tick_ns{};
+#else
+        futex_semaphore sem_ready{};
+#endif
         Context sched_ctx{};
 
 #ifdef __SCHED_CFS__
         constexpr static auto MAX_BACKOFF = 12;
-        using spin_lock_t = spin_lock_sleep;
+        using spin_lock_t = worker_lock_t<spin_lock_sleep>;
         /* lockness data structure */
         alignas(__CACHE_LINE__) spin_lock_t sched_lock{};
         QuaternaryHeap<sort_wrap, SortWrapLessCmp> ready{};
         QuaternaryHeap<sort_wrap, SortWrapLessCmp> ready_fixed{};
+#ifdef __SCHED_CFS_GROUP__
+        /* group entities compete with root coroutines by v_runtime */
+        QuaternaryHeap<group_wrap, SortWrapLessCmp> ready_group{};
+        /* group of the latest picked coroutine, off ready_group until the next pickup */
+        CfsGroupEntity * curr_group{};
+#endif
 #else
         static_assert(false);
 #endif
+#ifdef __SCHED_EDF__
+        /* coroutines with a deadline, ordered by deadline_ns, picked before cfs heaps */
+        QuaternaryHeap<sort_wrap, SortWrapLessCmp> ready_deadline{};
+        /* checked without sched_lock */
+        std::atomic<size_t> deadline_count{};
+        std::atomic<uint64_t> deadline_finished{};
+        std::atomic<uint64_t> deadline_missed{};
+        std::atomic<uint64_t> deadline_stolen{};
+        std::atomic<uint64_t> deadline_stolen_early{};
+#endif
+        /* WakeBatch applies to this scheduler and the coroutines in them */
+        std::atomic<uint64_t> batch_flushes{};
+        std::atomic<uint64_t> batch_wakeups{};
+#ifdef __SCHED_WAKE_AFFINE__
+        /* wakeups pulled to this scheduler by SchedManager::wake_affine */
+        std::atomic<uint64_t> wake_affine_pulls{};
+#endif
 
+#ifdef __SCHED_LOCAL_SLICE__
+        /* owner only, lowest v_runtime coroutines popped from cfs heap in batch */
+        constexpr static auto SLICE_SIZE = 16;
+        constexpr static auto SLICE_DEPTH_RATIO = 4;
+        constexpr static auto SLICE_GROW_STREAK = 4;
+        /* ~1ms, older slice is given back to cfs heap */
+        constexpr static uint64_t SLICE_MAX_AGE = 1 << 20;
+        std::array<Co_t *, SLICE_SIZE> slice{};
+        size_t slice_head{}, slice_size{}, slice_batch{1};
+        int slice_clean_streak{};
+        uint64_t slice_timestamp{};
+        /* set by push with lower v_runtime than the slice, refill on next pickup */
+        std::atomic<uint64_t> slice_limit{};
+        std::atomic<bool> slice_dirty{};
+#endif
+        std::thread::id owner_id{};
+        /* woken by the running coroutine, picked before cfs heap */
+        constexpr static auto RUNNEXT_MAX_STREAK = 16;
+        Co_t * runnext{};
+        int runnext_streak{};
+#ifdef __SCHED_HANDOFF__
+        /* switched out by handoff, its exec end is processed by the next coroutine */
+        Co_t * handoff_prev{};
+#endif
+
+        /* monotonic, written under sched_lock, v_runtime of migrating coroutines is rebased on it */
         std::atomic<uint64_t> min_v_runtime{};
         int latest_arg{};
         Co_t * running_co{};
+        /* tsc, maybe_yield of running_co yields after it */
+        uint64_t slice_deadline{};
+#ifdef __SCHED_PREEMPT__
+        /* stack left for co_async_preempt_entry and the yield path */
+        constexpr static uint64_t PREEMPT_STACK_RESERVE = 32 * 1024;
+        pthread_t owner_thread{};
+        /* tsc when running_co is switched in, 0 if not running a coroutine */
+        std::atomic<uint64_t> preempt_start_tsc{};
+#endif
         Co_t * await_callee{};
 
         struct SleepArgs
@@ -101,39 +238,110 @@ namespace co {
             std::chrono::microseconds sleep_until{};
         } sleep_args;
 
-        constexpr static auto APPLY_BUFFER_SIZE = 128;
-        boost::lockfree::queue<Co_t *, boost::lockfree::capacity<APPLY_BUFFER_SIZE>> buffer{};
+        /* remote wakeup without sched_lock, drained by owner */
+        InboxLockFree<Co_t, &Co_t::inbox_next> inbox{};
 
-        std::vector<Co_t *> pull_from_buffer();
+        std::vector<Co_t *> pull_from_inbox();
 
-        void pull_from_buffer(std::vector<Co_t *> &);
+        void pull_from_inbox(std::vector<Co_t *> &);
 
         void push_all_to_ready(const std::vector<sort_wrap> &, const std::vector<sort_wrap> &, bool);
 
         void push_to_ready(Co_t *co, bool);
 
+        void add_ready_count(size_t);
+
+        void sub_ready_count(size_t);
+
+        [[nodiscard]] bool is_owner() const;
+
         void get_ready_to_push(Co_t *co, uint64_t &);
 
         void apply_ready(Co_t *co);
 
         void apply_ready_lazy(Co_t *co);
 
-        void apply_ready_eager(Co_t *co, bool from_buffer = false);
+        void apply_ready_eager(Co_t *co, bool from_inbox = false);
 
         void apply_ready_all(
                 const std::vector<Co_t *> &co_vec,
                 std::unique_lock<spin_lock_t> & locker,
-                bool from_buffer = false,
+                bool from_inbox = false,
                 bool enable_lock = true,
                 bool unlock_exit = true
         );
 
         void remove_from_scheduler(Co_t *co);
+#ifdef __SCHED_EDF__
+        void push_to_deadline(Co_t *co);
+
+        [[nodiscard]] Co_t *pickup_deadline(std::unique_lock<spin_lock_t> &);
+
+        void pull_half_deadline(std::vector<Co_t *> &);
+
+        void finish_deadline(Co_t *co);
+#endif
+#ifdef __SCHED_CFS_GROUP__
+        CfsGroupEntity *group_entity(Co_t *co);
+
+        void push_to_group(const sort_wrap &);
+
+        void enqueue_group(CfsGroupEntity *);
+
+        void update_group_load(CfsGroupEntity *);
+
+        void charge_group(CfsGroupEntity *);
+
+        void put_prev_group();
+
+        [[nodiscard]] Co_t *pickup_from_group();
+
+        void pull_half_group(std::vector<Co_t *> &);
+
+        void release_group(Co_t *co);
+#endif
 
         [[nodiscard]] Co_t *pickup_ready();
 
+        void park();
+#ifdef __SINGLE_THREAD__
+        void tick();
+#endif
+
+        void up_min_v_runtime(uint64_t curr_v_runtime);
+
+        void detach_co(Co_t *co);
+#ifdef __SCHED_LOCAL_SLICE__
+        void check_slice(uint64_t priority);
+
+        [[nodiscard]] Co_t *pickup_from_slice(std::unique_lock<spin_lock_t> &);
+#endif
+
         void run(Co_t *co);
 
+        void prepare_run(Co_t *co);
+
+        bool try_runnext(Co_t *co);
+
+        [[nodiscard]] bool has_ready();
+
+        [[nodiscard]] Co_t *take_runnext();
+#ifdef __SCHED_HANDOFF__
+        void finish_handoff();
+#endif
+#if defined(__SCHED_HANDOFF__) || defined(__SCHED_PREEMPT__)
+        static Scheduler *current();
+#endif
+
+        static Co_t *current_co();
+#ifdef __SCHED_PREEMPT__
+        void check_preempt();
+
+        static void preempt_handler(int, siginfo_t *, void *);
+
+        static uint64_t async_preempt();
+#endif
+
         void coroutine_yield();
 
         void coroutine_await();
@@ -160,6 +368,7 @@ namespace co {
     class SchedManager {
     public:
         constexpr static uint64_t INF = 0x3f3f3f3f3f3f3f3f;
+        constexpr static size_t MAX_SCHEDULER_COUNT = 1024;
 
         /* for init */
         std::atomic<size_t> scheduler_count{};
@@ -168,22 +377,55 @@ namespace co {
         spin_lock init_lock{};
         spin_lock w_lock{};
 
-        explicit SchedManager(int thread_count) { schedulers.resize(thread_count); }
+        /* like golang "spinning M", at most 1/MAX_SPINNING_RATIO of schedulers steal at the same time */
+        constexpr static size_t MAX_SPINNING_RATIO = 2;
+        size_t max_spinning{1};
+        alignas(__CACHE_LINE__) std::atomic<size_t> spinning_count{};
+        /* strides coprime with scheduler count, for random victim order */
+        std::vector<size_t> steal_strides{};
+        /* scheduler index grouped by numa node */
+        std::vector<std::vector<int>> node_schedulers{};
+        /* set by scheduler before park, claimed by placement */
+        alignas(__CACHE_LINE__) std::atomic<int> idle_count{};
+        BitSetLockFree<MAX_SCHEDULER_COUNT> idle_schedulers{};
+
+#ifdef __SCHED_WAKE_AFFINE__
+        /* the wakee follows the waker if its own scheduler has WAKE_AFFINE_RATIO times the load */
+        constexpr static uint64_t WAKE_AFFINE_RATIO = 2;
+        constexpr static uint64_t WAKE_AFFINE_MIN_LOAD = 2;
+        /* ~1ms, at most one wake affine migration of a coroutine in it */
+        constexpr static uint64_t WAKE_AFFINE_INTERVAL = 1 << 20;
+#endif
+
+        explicit SchedManager(int thread_count);
 
         void apply_impl(Co_t *co, int flag);
 
+        int pick_scheduler();
+
+        int wake_target(Co_t *co);
+#ifdef __SCHED_WAKE_AFFINE__
+        int wake_affine(Co_t *co);
+#endif
+
+        void set_idle(int idx, bool idle);
+
         void apply(Co_t *co);
 
         void apply_eager(Co_t *co);
 
         void apply_lazy(Co_t *co);
 
+        void apply_batch(const std::vector<Co_t *> &co_vec);
+
         void wakeup_await_co_all(Co_t *await_callee);
 
         std::vector<Co_t *> stealing_work(int);
 
         void stealing_work(int, std::vector<Co_t *> &);
 
+        bool stealing_from(int, int, std::vector<Co_t *> &);
+
         void add_scheduler(Scheduler *s, int idx);
     };
 }
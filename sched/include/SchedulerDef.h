@@ -8,4 +8,6 @@ namespace co {
     class SchedEntity;
     class Scheduler;
     class SchedManager;
+    class BlockingPool;
+    struct CfsGroup;
 }
\ No newline at end of file
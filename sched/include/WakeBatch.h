@@ -0,0 +1,31 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "../../include/CoPrivate.h"
+#include "../../utils/include/preempt.h"
+
+namespace co {
+    /* wakeups grouped by target scheduler, each group is applied with one sched_lock and one sem_ready signal */
+    /* SchedManager::apply on this thread goes to the latest live batch, flushed on destruction */
+    /* not preemptible while alive, it must not span a switch */
+    class WakeBatch
+    {
+    private:
+        PreemptGuard guard{};
+        /* <scheduler index, coroutine> */
+        std::vector<std::pair<int, Co_t *>> wakeups{};
+        WakeBatch * prev{};
+    public:
+        WakeBatch();
+        WakeBatch(const WakeBatch &) = delete;
+        ~WakeBatch();
+
+        void add(Co_t * co);
+
+        void flush();
+
+        [[nodiscard]] static WakeBatch * current();
+    };
+}
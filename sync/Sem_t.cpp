@@ -14,13 +14,14 @@
 #include "../sched/include/Scheduler.h"
 #include "atomic_utils.h"
 #include "../timer/include/Timer.h"
+#include "../sched/include/WakeBatch.h"
 
 namespace co {
     Sem_t::Sem_t(uint32_t val)
     {
         m_value = val;
         init_count = val;
-        if constexpr (std::is_same_v<wait_q_t, LockedContainer<co_wrap, RandomStack<co_wrap>>>)
+        if constexpr (std::is_same_v<wait_q_t, LockedContainer<co_wrap, RandomStack<co_wrap>, worker_lock_t<spin_lock_sleep>>>)
         {
             for (auto & q : wait_q)
                 q = wait_q_t((uint64_t) co_ctx::clock.rdns());
@@ -85,6 +86,8 @@ namespace co {
             dec_max_spin();
         }
 
+        /* re-enabled when switched in */
+        preempt_disable();
         auto scheduler = co_ctx::loc->scheduler;
         auto co = scheduler->running_co;
         scheduler->interrupt(CO_WAITING);
@@ -155,6 +158,8 @@ namespace co {
 
         dec_max_spin();
 
+        /* re-enabled when switched in */
+        preempt_disable();
         auto scheduler = co_ctx::loc->scheduler;
         auto co = scheduler->running_co;
         scheduler->interrupt(CO_WAITING);
@@ -163,10 +168,10 @@ namespace co {
         co->sem_ptr = this;
 #endif
         /* 注册定时器 */
-        bool ans{};
-        auto timer_callback_fn = [&ans, this, co](bool is_timeout)
+        /* nothing of the frames of the waiter is touched by the timer or a signal, they may be written back with __STACK_STATIC__ */
+        auto wrap = co_wrap{co, callback};
+        wrap.timerTask = co_ctx::loc->timer->create_task([this, co](bool is_timeout)
         {
-            ans = !is_timeout;
             if (!is_timeout)
             {
 #ifdef __DEBUG_SEM_TRACE__
@@ -176,17 +181,13 @@ namespace co {
             }
 
 #ifdef __DEBUG_SEM_TRACE__
-            cb_args.co->sem_ptr = nullptr;
-            cb_args.co->sem_wakeup_reason.emplace_back("timeout fn");
+            co->sem_ptr = nullptr;
+            co->sem_wakeup_reason.emplace_back("timeout fn");
 #endif
             signal(false);
             co_ctx::manager->apply(co);
-        };
-        auto wrap = co_wrap{co, callback};
-        wrap.timerTask = co_ctx::loc->timer->create_task([&timer_callback_fn](bool is_timeout)
-        {
-            timer_callback_fn(is_timeout);
         });
+        auto task = wrap.timerTask;
 #ifdef __DEBUG_SEM_TRACE__
         wrap.co->cur_task = wrap.timerTask;
 #endif
@@ -200,7 +201,8 @@ namespace co {
 #endif
         /* goto scheduler */
         scheduler->jump_to_sched();
-        return ans;
+        /* canceled by a signal, or handled by the timer */
+        return task->get_canceled()->load(std::memory_order_acquire);
     }
 
     bool Sem_t::wait_for(std::chrono::microseconds duration)
@@ -263,22 +265,57 @@ namespace co {
         if ((cur_val >> WAITER_SHIFT) == 0)
             return;
 
-        /* exec the callback and push to scheduler */
-        auto cur_co = co_ctx::loc->scheduler->running_co;
-        std::optional<co_wrap> wrap_opt{};
-        while (true)
+        auto co = pick_waiter(call_func);
+        if (co == nullptr)
+            return;
+
+        /* woken by the running coroutine on the same scheduler, keep the data hot */
+        if (co_ctx::loc->scheduler->try_runnext(co))
+            return;
+
+        co_ctx::manager->apply(co);
+    }
+
+    /* wake up to n waiters with one update of m_value, applied per scheduler in one batch */
+    void Sem_t::signal_n(uint32_t n)
+    {
+        if (n == 0)
+            return;
+
+        auto add_count_fn = [n](uint64_t cur_value) -> uint64_t
         {
-            wrap_opt = pick_from_wait_q();
-            auto & wrap = wrap_opt.value();
-            /* handle timeout */
-            if (wrap.timerTask && !wrap.timerTask->cancel())
-            {
-                return;
-            } else {
-                break;
-            }
+            uint64_t woken = std::min<uint64_t>(cur_value >> WAITER_SHIFT, n);
+            uint64_t rest = n - woken;
+            if (UNLIKELY((cur_value & COUNT_MASK) + rest > COUNT_MAX))
+                throw SemOverflowException();
+
+            return cur_value - (woken << WAITER_SHIFT) + rest;
+        };
+        auto cur_val = atomic_fetch_modify(m_value, add_count_fn);
+        auto woken = std::min<uint64_t>(cur_val >> WAITER_SHIFT, n);
+        if (woken == 0)
+            return;
+
+        WakeBatch batch{};
+        for (uint64_t i = 0; i < woken; i++)
+        {
+            auto co = pick_waiter(true);
+            if (co != nullptr)
+                batch.add(co);
         }
+    }
+
+    /* a waiter is taken off m_value, nullptr if it is timed out and woken by the timer */
+    Co_t * Sem_t::pick_waiter(bool call_func)
+    {
+        /* exec the callback and push to scheduler */
+        auto cur_co = Scheduler::current_co();
+        auto wrap_opt = pick_from_wait_q();
         auto & wrap = wrap_opt.value();
+        /* handle timeout */
+        if (wrap.timerTask && !wrap.timerTask->cancel())
+            return nullptr;
+
 #ifdef __DEBUG_SEM_TRACE__
         wrap.co->sem_ptr = nullptr;
         wrap.co->sem_wakeup_reason.emplace_back("signal");
@@ -286,7 +323,7 @@ namespace co {
         if (call_func && wrap.func)
             wrap.func(cur_co);
 
-        co_ctx::manager->apply(wrap.co);
+        return wrap.co;
     }
 
     void Sem_t::release(Sem_t *sem)
@@ -13,12 +13,15 @@ namespace co {
 
     Sem_t * sem_create(uint32_t count)
 	{
-		auto sem = static_cast<Sem_t*>(co_ctx::loc->alloc.sem_pool.allocate(sizeof (Sem_t)));
+		/* freed to the pool it came from, the caller may migrate in between */
+		PreemptGuard guard{};
+		auto & pool = co_ctx::loc->alloc.sem_pool;
+		auto sem = static_cast<Sem_t*>(pool.allocate(sizeof (Sem_t)));
 		if (UNLIKELY(sem == nullptr))
 			return nullptr;
 
         sem_construct(sem, count);
-		sem->alloc = &co_ctx::loc->alloc.sem_pool;
+		sem->alloc = &pool;
 		return sem;
 	}
 
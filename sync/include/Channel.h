@@ -32,8 +32,8 @@ namespace co {
 	{
 	private:
         //RingBufferLockFree<T> buffer{SIZE};
-        RingBufferLock<T, SIZE> buffer{};
-        std::atomic<bool> is_close{false};
+        RingBufferLock<T, SIZE, std::allocator<T>, worker_lock_t<spin_lock_sleep>> buffer{};
+        worker_atomic_t<bool> is_close{false};
 		Semaphore sender{}, receiver{SIZE};
         Semaphore full{}, empty{SIZE};
 	public:
@@ -105,7 +105,8 @@ namespace co {
                 full.signal();
             }
 #else
-            receiver.wait();
+            if (!receiver.wait_for(duration))
+                return false;
             buffer.push(std::forward<V>(x));
 #endif
             sender.signal();
@@ -147,7 +148,7 @@ namespace co {
 				throw ChannelClosedException();
 
 #ifdef __STACK_DYN__
-            auto cur_co = co_ctx::loc->scheduler->running_co;
+            auto cur_co = Scheduler::current_co();
             cur_co->recv_buffer = std::addressof(ans);
             cur_co->buffer_has_value = false;
 
@@ -161,7 +162,7 @@ namespace co {
             }
 #else
             sender.wait();
-            ans = buffer.pop(ans);
+            buffer.pop(ans);
             receiver.signal();
 #endif
 		}
@@ -172,7 +173,7 @@ namespace co {
                 throw ChannelClosedException();
 
 #ifdef __STACK_DYN__
-            auto cur_co = co_ctx::loc->scheduler->running_co;
+            auto cur_co = Scheduler::current_co();
             cur_co->recv_buffer = std::addressof(ans);
             cur_co->buffer_has_value = false;
 
@@ -195,8 +196,9 @@ namespace co {
                 empty.signal();
             }
 #else
-            sender.wait_for(duration);
-            ans = buffer.pop(ans);
+            if (!sender.wait_for(duration))
+                return false;
+            buffer.pop(ans);
             receiver.signal();
 #endif
             return true;
@@ -18,6 +18,7 @@
 #include "../../data_structure/include/RandomStack.h"
 #include "../../data_structure/include/Stack.h"
 #include "../../utils/include/sem_utils.h"
+#include "../../utils/include/single_thread.h"
 
 namespace co {
     class SemClosedException : public std::exception {
@@ -38,7 +39,12 @@ namespace co {
     class Sem_t {
     private:
         constexpr static auto MIN_SPIN = 1;
+#ifdef __SINGLE_THREAD__
+        /* no signal can arrive while spinning */
+        constexpr static auto MAX_SPIN = 1;
+#else
         constexpr static auto MAX_SPIN = 64;
+#endif
         constexpr static auto SPIN_LEVEL = 8;
         constexpr static auto COUNT_MASK = 0xffffffff;
         constexpr static auto WAITER_SHIFT = 32;
@@ -78,17 +84,17 @@ namespace co {
             bool operator < (const co_wrap & oth) const { return co < oth.co; }
         };
 
-        using wait_q_t = LockedContainer<co_wrap, RandomStack<co_wrap>>;
+        using wait_q_t = LockedContainer<co_wrap, RandomStack<co_wrap>, worker_lock_t<spin_lock_sleep>>;
 
-        std::atomic<uint64_t> m_value{};
+        worker_atomic_t<uint64_t> m_value{};
         uint32_t init_count{};
-        std::atomic<int32_t> max_spin{MAX_SPIN};
-        std::atomic<uint32_t> q_push_idx{};
+        worker_atomic_t<int32_t> max_spin{MAX_SPIN};
+        worker_atomic_t<uint32_t> q_push_idx{};
         std::array<wait_q_t, QUEUE_NUMBER> wait_q{};
-        std::atomic<uint32_t> q_pop_idx{};
-        MultiSetLock<co_wrap> cancelable_wait{};
+        worker_atomic_t<uint32_t> q_pop_idx{};
+        MultiSetLock<co_wrap, std::less<co_wrap>, worker_lock_t<spin_lock_sleep>> cancelable_wait{};
         
-        alignas(__CACHE_LINE__) std::atomic<size_t> m_size{};
+        alignas(__CACHE_LINE__) worker_atomic_t<size_t> m_size{};
 
 #ifdef __MEM_PMR__
         std::pmr::synchronized_pool_resource * alloc{};
@@ -107,6 +113,8 @@ namespace co {
         void wait_then(const callback_t & callback);
         bool try_wait();
         void signal(bool call_func = true);
+        void signal_n(uint32_t n);
+        Co_t * pick_waiter(bool call_func);
         static void release(Sem_t *ptr);
         std::optional<co_wrap> pick_from_wait_q();
         void inc_max_spin();
@@ -44,6 +44,7 @@ namespace co {
 		inline ~Semaphore();
 
 		inline void signal();
+		inline void signal(uint32_t n);
 		inline void wait();
         inline void wait_then(const callback_t &);
         inline bool wait_for(std::chrono::microseconds duration);
@@ -87,6 +88,15 @@ namespace co {
         handle->signal();
 	}
 
+	/* wake up to n waiters at once */
+	void Semaphore::signal(uint32_t n)
+	{
+		if (UNLIKELY(handle == nullptr))
+			throw SemaphoreUnInitializationException();
+
+        handle->signal_n(n);
+	}
+
 	void Semaphore::wait()
 	{
 		if (UNLIKELY(handle == nullptr))
@@ -6,6 +6,16 @@
 #include <string>
 #include <atomic>
 #include <chrono>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <stdexcept>
+#include <fstream>
+#include <string_view>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "include/test.h"
 #include "../include/Coroutine.h"
@@ -49,6 +59,43 @@ Ret benchmark(Fn && fn, Args &&... args)
     }
 }
 
+/* busy loop with safepoints while keep_on(iteration) holds, returns the iterations and the safepoints that yielded */
+template<typename Fn>
+static std::pair<uint64_t, uint64_t> spin_while(Fn && keep_on)
+{
+    uint64_t j = 0, yields = 0;
+    for (; keep_on(j); j++)
+        yields += co::safepoint(j);
+    return {j, yields};
+}
+
+/* busy loop with safepoints for the duration */
+static std::pair<uint64_t, uint64_t> spin_for(std::chrono::steady_clock::duration duration)
+{
+    auto end_time = std::chrono::steady_clock::now() + duration;
+    return spin_while([end_time] (uint64_t) { return std::chrono::steady_clock::now() < end_time; });
+}
+
+/* coroutines park() until released, the creator waits until n of them parked */
+struct park_gate
+{
+    co::Semaphore start{}, done{};
+
+    void park()
+    {
+        done.signal();
+        start.wait();
+    }
+
+    void wait_parked(int n)
+    {
+        for (int i = 0; i < n; i++)
+            done.wait();
+    }
+
+    void release(int n) { start.signal(n); }
+};
+
 void basic_test()
 {
 	std::cout << "basic test" << std::endl;
@@ -407,6 +454,348 @@ void channel_timed_test()
     end_of_test();
 }
 
+void ping_pong_test()
+{
+    constexpr auto switch_round = 1000000;
+    using chan_t = co::Channel<int>;
+
+    std::cout << "coroutine ping pong test" << std::endl;
+
+    /* semaphore */
+    co::Semaphore ping{}, pong{};
+    start_cal();
+    co::Co<void> sem_pong{[&ping, &pong] ()
+    {
+        for (int i = 0; i < switch_round; i++)
+        {
+            ping.wait();
+            pong.signal();
+        }
+    }};
+    for (int i = 0; i < switch_round; i++)
+    {
+        ping.signal();
+        pong.wait();
+    }
+    sem_pong.await();
+    std::cout << "semaphore ping pong round = " << switch_round << std::endl;
+    end_cal();
+
+    /* channel */
+    chan_t ping_chan{}, pong_chan{};
+    int64_t sum{};
+    start_cal();
+    co::Co<void> chan_pong{[&ping_chan, &pong_chan] ()
+    {
+        for (int i = 0; i < switch_round; i++)
+        {
+            int x{};
+            ping_chan >> x;
+            pong_chan << x;
+        }
+    }};
+    for (int i = 0; i < switch_round; i++)
+    {
+        int x{};
+        ping_chan << i;
+        pong_chan >> x;
+        sum += x;
+    }
+    chan_pong.await();
+    assert(sum == (int64_t) switch_round * (switch_round - 1) / 2 && "wrong ping pong result");
+    std::cout << "channel ping pong round = " << switch_round << std::endl;
+    end_cal();
+
+    end_of_test();
+}
+
+void spawn_batch_test()
+{
+    constexpr auto coroutine_cnt = 100000;
+    std::cout << "coroutine spawn batch test" << std::endl;
+
+    std::vector<int> input(coroutine_cnt);
+    for (int i = 0; i < coroutine_cnt; i++)
+        input[i] = i;
+
+    start_cal();
+    auto batch = co::spawn_batch(input, [] (int x) -> int64_t { return x * 2; });
+    auto res = batch.await_all();
+    end_cal();
+
+    int64_t sum{};
+    for (auto x : res)
+        sum += x;
+    assert(sum == (int64_t) coroutine_cnt * (coroutine_cnt - 1) && "wrong batch result");
+
+    std::atomic<int> g_count{};
+    co::spawn_batch(input, [&g_count] (int) { g_count.fetch_add(1, std::memory_order_relaxed); }).await_all();
+    std::cout << "coroutine spawn batch count = " << g_count << std::endl;
+
+    /* one CoAttr for the whole batch, frames fit the 16 KB stack class */
+    std::atomic<int> small_count{};
+    co::spawn_batch(input, [&small_count] (int x)
+    {
+        volatile char frame[8 * 1024];
+        frame[x % sizeof(frame)] = 1;
+        small_count.fetch_add(frame[x % sizeof(frame)], std::memory_order_relaxed);
+    }, co::CoAttr{.stack_size = 16 * 1024}).await_all();
+    assert(small_count == coroutine_cnt && "wrong batch count");
+
+    end_of_test();
+}
+
+void maybe_yield_test()
+{
+    constexpr auto busy_time = std::chrono::milliseconds(500);
+    std::cout << "coroutine maybe yield test" << std::endl;
+
+    /* more busy loops than workers, the probe runs early only if they yield */
+    auto busy_cnt = co::worker_count() * 2;
+    std::atomic<int64_t> yield_cnt{};
+    std::vector<co::Co<void>> busy{};
+    busy.reserve(busy_cnt);
+    for (int i = 0; i < busy_cnt; i++)
+    {
+        busy.emplace_back([&yield_cnt, busy_time] ()
+        {
+            yield_cnt.fetch_add(spin_for(busy_time).second, std::memory_order_relaxed);
+        });
+    }
+
+    /* sleep 10ms then await a probe, about busy_time if the busy coroutines never yield */
+    auto probe_start = std::chrono::steady_clock::now();
+    co::sleep(std::chrono::milliseconds(10));
+    co::Co<void>{[] () {}}.await();
+    auto probe_time = std::chrono::steady_clock::now() - probe_start;
+    std::cout << "sleep 10ms and probe with " << busy_cnt << " busy coroutine, time cost: "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(probe_time).count() << "ms" << std::endl;
+
+    for (auto & co : busy)
+        co.await();
+    std::cout << "maybe yield count = " << yield_cnt << std::endl;
+    assert(yield_cnt > 0 && "busy coroutines never yielded at a safepoint");
+    assert(probe_time < busy_time / 2 && "probe waited for the busy coroutines");
+
+    end_of_test();
+}
+
+void preempt_test()
+{
+    constexpr auto busy_time = std::chrono::milliseconds(200);
+    std::cout << "coroutine preempt test" << std::endl;
+
+    /* busy loops without safepoint, the probe runs early only with __SCHED_PREEMPT__ */
+    auto busy_cnt = co::worker_count() * 2;
+    std::vector<co::Co<uint64_t>> busy{};
+    busy.reserve(busy_cnt);
+    for (int i = 0; i < busy_cnt; i++)
+    {
+        busy.emplace_back([busy_time] () -> uint64_t
+        {
+            auto end_time = std::chrono::steady_clock::now() + busy_time;
+            uint64_t x = 1;
+            while (std::chrono::steady_clock::now() < end_time)
+            {
+                for (int j = 0; j < 1024; j++)
+                    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            }
+            return x;
+        });
+    }
+
+    /* sleep 10ms then await a probe, about busy_time if the busy coroutines are never preempted */
+    auto probe_start = std::chrono::steady_clock::now();
+    co::sleep(std::chrono::milliseconds(10));
+    co::Co<void>{[] () {}}.await();
+    auto probe_time = std::chrono::steady_clock::now() - probe_start;
+    std::cout << "sleep 10ms and probe with " << busy_cnt << " busy coroutine, time cost: "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(probe_time).count() << "ms" << std::endl;
+#ifdef __SCHED_PREEMPT__
+    assert(probe_time < busy_time / 2 && "busy coroutines not preempted");
+#endif
+
+    uint64_t sum{};
+    for (auto & co : busy)
+        sum += co.await();
+    std::cout << "busy result = " << sum << std::endl;
+
+    end_of_test();
+}
+
+void spawn_blocking_test()
+{
+    constexpr auto block_time = std::chrono::milliseconds(100);
+    std::cout << "coroutine spawn blocking test" << std::endl;
+
+    /* more blocking calls than workers, the probe runs early only if they are offloaded */
+    auto block_cnt = co::worker_count() * 4;
+    std::vector<co::Co<int>> block{};
+    block.reserve(block_cnt);
+    for (int i = 0; i < block_cnt; i++)
+    {
+        block.emplace_back([block_time] (int x) -> int
+        {
+            return co::spawn_blocking([block_time] (int y)
+            {
+                std::this_thread::sleep_for(block_time);
+                return y * 2;
+            }, x);
+        }, i);
+    }
+
+    start_cal();
+    co::Co<void>{[] () {}}.await();
+    std::cout << "probe with " << block_cnt << " blocking coroutine" << std::endl;
+    end_cal();
+
+    int64_t sum{};
+    for (auto & co : block)
+        sum += co.await();
+    assert(sum == (int64_t) block_cnt * (block_cnt - 1) && "wrong blocking result");
+
+    bool caught = false;
+    try {
+        co::spawn_blocking([] () { throw std::runtime_error("blocking"); });
+    } catch (const std::runtime_error &) {
+        caught = true;
+    }
+    assert(caught && "blocking exception lost");
+    std::cout << "spawn blocking sum = " << sum << std::endl;
+
+    end_of_test();
+}
+
+void sched_group_test()
+{
+    constexpr auto window = std::chrono::milliseconds(300);
+    std::cout << "coroutine sched group test" << std::endl;
+
+    /* same weigh, group b has 32 times more coroutines, they share cpu about 1 : 1 with __SCHED_CFS_GROUP__ */
+    /* the weigh of a group is split across workers by its load there */
+    /* all coroutines stop at the end of the same window, work is compared over it */
+    auto few_cnt = co::worker_count();
+    auto many_cnt = co::worker_count() * 32;
+    co::SchedGroup group_a{}, group_b{};
+    std::atomic<uint64_t> work_a{}, work_b{};
+    std::atomic<bool> stop{};
+    auto busy_fn = [&stop] (std::atomic<uint64_t> & work)
+    {
+        auto iter = spin_while([&stop] (uint64_t) { return !stop.load(std::memory_order_relaxed); }).first;
+        work.fetch_add(iter, std::memory_order_relaxed);
+    };
+
+    std::vector<co::Co<void>> busy{};
+    busy.reserve(few_cnt + many_cnt);
+    start_cal();
+    for (int i = 0; i < few_cnt; i++)
+        busy.emplace_back(group_a, busy_fn, std::ref(work_a));
+    for (int i = 0; i < many_cnt; i++)
+        busy.emplace_back(group_b, busy_fn, std::ref(work_b));
+    co::sleep(window);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto & co : busy)
+        co.await();
+    end_cal();
+
+    auto ratio = (double) work_b / (double) std::max<uint64_t>(work_a, 1);
+    std::cout << "group a (" << few_cnt << " coroutine) work = " << work_a << std::endl;
+    std::cout << "group b (" << many_cnt << " coroutine) work = " << work_b << std::endl;
+    std::cout << "work b / a = " << ratio << std::endl;
+#ifdef __SCHED_CFS_GROUP__
+    /* about 32 without groups */
+    assert(ratio > 0.5 && ratio < 2.0 && "groups of the same weigh do not share cpu evenly");
+#endif
+
+    end_of_test();
+}
+
+void deadline_test()
+{
+    constexpr auto busy_time = std::chrono::milliseconds(200);
+    constexpr auto deadline_cnt = 100;
+    std::cout << "coroutine deadline test" << std::endl;
+
+    /* cfs background work, deadline coroutines go first with __SCHED_EDF__ */
+    auto busy_cnt = co::worker_count() * 8;
+    std::vector<co::Co<void>> busy{};
+    busy.reserve(busy_cnt);
+    constexpr int busy_nice = co::PRIORITY_BACKGROUND;
+    for (int i = 0; i < busy_cnt; i++)
+    {
+        busy.emplace_back(busy_nice, [busy_time] () { spin_for(busy_time); });
+    }
+
+    /* later created, earlier deadline, edf finishes them in reverse */
+    auto stats_begin = co::deadline_stats();
+    std::atomic<int> finish_seq{};
+    std::vector<int> finish_at(deadline_cnt);
+    std::vector<co::Co<int>> urgent{};
+    urgent.reserve(deadline_cnt);
+    start_cal();
+    auto deadline_base = std::chrono::steady_clock::now() + std::chrono::milliseconds(5);
+    for (int i = 0; i < deadline_cnt; i++)
+    {
+        auto deadline = co::Deadline{deadline_base + std::chrono::microseconds(10) * (deadline_cnt - i)};
+        urgent.emplace_back(deadline, [&finish_seq, &finish_at] (int x)
+        {
+            finish_at[x] = finish_seq.fetch_add(1);
+            return x + 1;
+        }, i);
+    }
+
+    int64_t sum{};
+    for (auto & co : urgent)
+        sum += co.await();
+    assert(sum == (int64_t) deadline_cnt * (deadline_cnt + 1) / 2 && "wrong deadline result");
+    std::cout << deadline_cnt << " deadline coroutine with " << busy_cnt << " busy coroutine" << std::endl;
+    end_cal();
+
+    for (auto & co : busy)
+        co.await();
+    auto stats = co::deadline_stats();
+    auto finished = stats.finished - stats_begin.finished;
+    auto missed = stats.missed - stats_begin.missed;
+    int inversion{};
+    for (int i = 1; i < deadline_cnt; i++)
+        inversion += finish_at[i] > finish_at[i - 1];
+    std::cout << "deadline finished = " << finished << ", missed = " << missed
+              << ", finish order inversion = " << inversion << std::endl;
+#ifdef __SCHED_EDF__
+    assert(finished == deadline_cnt && "deadline coroutine not counted");
+    /* one worker picks strictly by deadline, workers running in parallel finish in any order */
+    if (co::worker_count() == 1)
+        assert(inversion == 0 && "deadline coroutines not finished in edf order");
+#endif
+
+    /* no background work, a worker done with its deadline coroutines steals the latest ones of another */
+    auto spread_cnt = deadline_cnt * co::worker_count();
+    auto steal_begin = co::deadline_stats();
+    std::vector<co::Co<void>> spread{};
+    spread.reserve(spread_cnt);
+    auto spread_base = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+    for (int i = 0; i < spread_cnt; i++)
+    {
+        /* deadlines in a scrambled order, the last slots of a heap are not the latest */
+        auto deadline = co::Deadline{spread_base + std::chrono::microseconds(10) * (i * 37 % spread_cnt)};
+        /* uneven work, the workers that got the light ones run out first */
+        spread.emplace_back(deadline, [i] () { spin_for(std::chrono::microseconds(i % 8 == 0 ? 1000 : 50)); });
+    }
+    for (auto & co : spread)
+        co.await();
+    auto steal_end = co::deadline_stats();
+    auto stolen = steal_end.stolen - steal_begin.stolen;
+    auto stolen_early = steal_end.stolen_early - steal_begin.stolen_early;
+    std::cout << spread_cnt << " deadline coroutine, stolen = " << stolen << ", stolen before a deadline kept by the victim = " << stolen_early << std::endl;
+#ifdef __SCHED_EDF__
+    assert(stolen_early == 0 && "thief took an urgent deadline coroutine");
+    if (co::worker_count() > 1)
+        assert(stolen > 0 && "no deadline coroutine stolen");
+#endif
+
+    end_of_test();
+}
+
 int fib_await(int x)
 {
     if (x <= 2)
@@ -425,6 +814,572 @@ int fib_normal(int x)
     return fib_normal(x - 1) + fib_normal(x - 2);
 }
 
+void vruntime_skew_test()
+{
+    constexpr auto busy_time = std::chrono::milliseconds(500);
+    constexpr auto sleep_round = 1 << 12;
+    std::cout << "coroutine vruntime skew test" << std::endl;
+
+    /* same nice, they migrate by stealing and sleep wakeups, work should be about the same */
+    auto busy_cnt = co::worker_count() * 8;
+    std::vector<uint64_t> work(busy_cnt);
+    std::vector<co::Co<void>> busy{};
+    busy.reserve(busy_cnt);
+    start_cal();
+    for (int i = 0; i < busy_cnt; i++)
+    {
+        busy.emplace_back([busy_time, &work, i] ()
+        {
+            auto end_time = std::chrono::steady_clock::now() + busy_time;
+            work[i] = spin_while([end_time] (uint64_t j)
+            {
+                /* woken by timer, placed on any scheduler */
+                if (j % sleep_round == sleep_round - 1)
+                    co::sleep(std::chrono::microseconds(100));
+                return std::chrono::steady_clock::now() < end_time;
+            }).first;
+        });
+    }
+    for (auto & co : busy)
+        co.await();
+    end_cal();
+
+    auto [min_it, max_it] = std::minmax_element(work.begin(), work.end());
+    auto skew = (double) *max_it / (double) std::max<uint64_t>(*min_it, 1);
+    std::cout << busy_cnt << " coroutine, work min = " << *min_it << ", max = " << *max_it
+              << ", skew = " << skew << std::endl;
+#ifdef __SCHED_CFS__
+    /* about 2 without the rebase of vruntime on migration */
+    assert(skew < 2.0 && "coroutines of the same nice got unequal cpu");
+#endif
+
+    end_of_test();
+}
+
+void wake_affine_test()
+{
+    constexpr auto busy_time = std::chrono::milliseconds(300);
+    constexpr auto switch_round = 20000;
+    std::cout << "coroutine wake affine test" << std::endl;
+
+    /* busy schedulers, the woken side follows its waker with __SCHED_WAKE_AFFINE__ */
+    auto busy_cnt = co::worker_count() * 4;
+    std::vector<co::Co<void>> busy{};
+    busy.reserve(busy_cnt);
+    for (int i = 0; i < busy_cnt; i++)
+    {
+        busy.emplace_back([busy_time] () { spin_for(busy_time); });
+    }
+
+    /* many pairs, a pair split over two schedulers is woken across them, the busier side moves once */
+    auto migrations_begin = co::wake_affine_stats().migrations;
+    auto pair_cnt = co::worker_count() * 16;
+    std::vector<co::Semaphore> ping(pair_cnt), pong(pair_cnt);
+    std::vector<co::Co<void>> pairs{};
+    pairs.reserve(pair_cnt * 2);
+    start_cal();
+    for (int i = 0; i < pair_cnt; i++)
+    {
+        pairs.emplace_back([&ping, &pong, i] ()
+        {
+            for (int j = 0; j < switch_round; j++)
+            {
+                ping[i].wait();
+                pong[i].signal();
+            }
+        });
+        pairs.emplace_back([&ping, &pong, i] ()
+        {
+            for (int j = 0; j < switch_round; j++)
+            {
+                ping[i].signal();
+                pong[i].wait();
+            }
+        });
+    }
+    for (auto & co : pairs)
+        co.await();
+    std::cout << pair_cnt << " ping pong pair, round = " << switch_round << " with " << busy_cnt << " busy coroutine" << std::endl;
+    end_cal();
+
+    for (auto & co : busy)
+        co.await();
+    auto migrations = co::wake_affine_stats().migrations - migrations_begin;
+    std::cout << "wake affine migrations = " << migrations << std::endl;
+#ifdef __SCHED_WAKE_AFFINE__
+    /* one worker has no other scheduler to move to */
+    if (co::worker_count() > 1)
+        assert(migrations > 0 && "no wakeup followed its waker");
+    else
+        assert(migrations == 0);
+#endif
+
+    end_of_test();
+}
+
+void wake_batch_test()
+{
+    constexpr auto waiter_cnt = 10000;
+    constexpr auto wake_round = 20;
+    std::cout << "coroutine wake batch test" << std::endl;
+
+    /* n signal() or one signal(n), waiters of signal(n) are applied with one batch per target scheduler */
+    for (auto batch : {false, true})
+    {
+        std::atomic<int> woken{};
+        std::chrono::nanoseconds signal_time{}, wake_time{};
+        for (int r = 0; r < wake_round; r++)
+        {
+            park_gate gate{};
+            std::vector<co::Co<void>> waiters{};
+            waiters.reserve(waiter_cnt);
+            for (int i = 0; i < waiter_cnt; i++)
+            {
+                waiters.emplace_back([&gate, &woken] ()
+                {
+                    gate.park();
+                    woken.fetch_add(1, std::memory_order_relaxed);
+                });
+            }
+            gate.wait_parked(waiter_cnt);
+
+            auto stats_begin = co::wake_batch_stats();
+            auto wake_start = std::chrono::steady_clock::now();
+            if (batch)
+            {
+                gate.release(waiter_cnt);
+            } else {
+                for (int i = 0; i < waiter_cnt; i++)
+                    gate.start.signal();
+            }
+            signal_time += std::chrono::steady_clock::now() - wake_start;
+            auto stats_end = co::wake_batch_stats();
+            auto flushes = stats_end.flushes - stats_begin.flushes;
+            auto wakeups = stats_end.wakeups - stats_begin.wakeups;
+            /* a waiter between the two semaphores of park() takes a permit instead */
+            if (batch)
+            {
+                assert(wakeups <= waiter_cnt && (wakeups > 0) == (flushes > 0));
+                assert(flushes <= (uint64_t) co::worker_count() && "more than one apply per scheduler");
+            } else {
+                assert(flushes == 0 && wakeups == 0);
+            }
+
+            for (auto & co : waiters)
+                co.await();
+            wake_time += std::chrono::steady_clock::now() - wake_start;
+        }
+        assert(woken == waiter_cnt * wake_round && "lost wakeup");
+        std::cout << (batch ? "signal(n)" : "n * signal()") << ", " << waiter_cnt << " waiter, round = " << wake_round
+                  << ", signal time = " << std::chrono::duration_cast<std::chrono::milliseconds>(signal_time).count() << "ms"
+                  << ", wake time = " << std::chrono::duration_cast<std::chrono::milliseconds>(wake_time).count() << "ms" << std::endl;
+    }
+
+    end_of_test();
+}
+
+/* virtual and resident bytes of this process, from /proc/self/statm */
+static std::pair<int64_t, int64_t> statm_bytes()
+{
+    int64_t size{}, resident{};
+    std::ifstream{"/proc/self/statm"} >> size >> resident;
+    return {size * sysconf(_SC_PAGESIZE), resident * sysconf(_SC_PAGESIZE)};
+}
+
+static int64_t rss_bytes()
+{
+    return statm_bytes().second;
+}
+
+void stack_rss_test()
+{
+    constexpr auto parked_cnt = 20000;
+    constexpr auto frame_size = 1024;
+    std::cout << "coroutine stack rss test" << std::endl;
+
+    /* parked coroutines with a small frame, rss per coroutine follows the touched pages of the stack */
+    park_gate gate{};
+    std::atomic<int> sum{};
+    std::vector<co::Co<void>> parked{};
+    parked.reserve(parked_cnt);
+    auto rss_begin = rss_bytes();
+    for (int i = 0; i < parked_cnt; i++)
+    {
+        parked.emplace_back([&gate, &sum, i] ()
+        {
+            volatile char frame[frame_size];
+            frame[0] = static_cast<char>(i);
+            gate.park();
+            sum.fetch_add(frame[0] == static_cast<char>(i), std::memory_order_relaxed);
+        });
+    }
+    gate.wait_parked(parked_cnt);
+
+    auto rss_parked = rss_bytes() - rss_begin;
+    gate.release(parked_cnt);
+    for (auto & co : parked)
+        co.await();
+
+    assert(sum == parked_cnt && "stack corrupted");
+    std::cout << parked_cnt << " parked coroutine, rss = " << (rss_parked >> 20) << "MB, "
+              << rss_parked / parked_cnt << " bytes per coroutine" << std::endl;
+#ifdef __STACK_DYN_GUARD__
+    /* the touched top page of the stack and the coroutine itself, not the whole stack */
+    assert(rss_parked / parked_cnt < 2 * 4096 && "untouched stack pages committed");
+#endif
+
+    end_of_test();
+}
+
+static int overflow_walk(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = static_cast<char>(depth);
+    if (depth == INT32_MAX)
+        return frame[0];
+
+    return overflow_walk(depth + 1) + frame[0];
+}
+
+void stack_overflow_test()
+{
+    std::cout << "coroutine stack overflow test" << std::endl;
+
+#if !defined(__STACK_DYN_GUARD__) || !defined(__SINGLE_THREAD__)
+    /* the guard is needed for the report, a fork only keeps a one thread runtime usable */
+    std::cout << "skipped, needs __STACK_DYN_GUARD__ and __SINGLE_THREAD__" << std::endl;
+#else
+    /* the child overflows a 16 KB stack into its guard, reports it on stderr and dies of SIGSEGV */
+    int err_pipe[2];
+    assert(pipe(err_pipe) == 0 && "pipe failed");
+    auto pid = fork();
+    assert(pid >= 0 && "fork failed");
+    if (pid == 0)
+    {
+        dup2(err_pipe[1], STDERR_FILENO);
+        int res = co::Co<int>{co::CoAttr{.stack_size = 16 * 1024}, overflow_walk, 0}.await();
+        std::exit(res);
+    }
+
+    close(err_pipe[1]);
+    int status{};
+    waitpid(pid, &status, 0);
+    char report[512]{};
+    auto len = read(err_pipe[0], report, sizeof(report) - 1);
+    close(err_pipe[0]);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV && "overflow did not end in SIGSEGV");
+    assert(len > 0 && std::string_view{report}.find("coroutine stack overflow: coroutine") != std::string_view::npos
+           && "overflow not reported");
+    std::cout << "child killed by signal " << WTERMSIG(status) << ", report: " << report;
+#endif
+
+    end_of_test();
+}
+
+void stack_class_test()
+{
+    constexpr auto parked_cnt = 20000;
+    constexpr auto deep_frame = 64 * 1024;
+    std::cout << "coroutine stack class test" << std::endl;
+
+    /* a frame bigger than the small classes runs on a 256 KB stack */
+    int deep = co::Co<int>{co::CoAttr{.stack_size = 256 * 1024}, [] ()
+    {
+        volatile char frame[deep_frame];
+        frame[0] = 1;
+        frame[deep_frame - 1] = 2;
+        return frame[0] + frame[deep_frame - 1];
+    }}.await();
+    assert(deep == 3 && "stack corrupted");
+
+    /* parked coroutines, address space per coroutine follows the stack class */
+    std::size_t workers = co::worker_count();
+#ifdef __STACK_DYN__
+    /* a worker pool maps stacks in blocks of max(8 * workers, 64) largest stacks and caches as many freed ones */
+    /* the vm delta is off by up to about two blocks per worker */
+    auto block_slack = static_cast<int64_t>(2 * workers * (std::max<std::size_t>(workers * 8, 64) + 4) * co::MAX_STACK_SIZE);
+#endif
+    /* the previous test left default stacks */
+    std::size_t prev_size = 0;
+    for (std::size_t stack_size : {std::size_t{0}, std::size_t{16 * 1024}})
+    {
+        /* stacks of the previous round freed by a stealing worker go back to their pool on its next alloc */
+        /* let every worker take them back before the baseline, or the round measures their unmap */
+        std::vector<co::Co<void>> settle{};
+        for (std::size_t i = 0; i < workers * 64; i++)
+            settle.emplace_back(co::CoAttr{.stack_size = prev_size}, [] () {});
+        for (auto & co : settle)
+            co.await();
+        settle.clear();
+
+        park_gate gate{};
+        std::vector<co::Co<void>> parked{};
+        parked.reserve(parked_cnt);
+        auto [vm_begin, rss_begin] = statm_bytes();
+        for (int i = 0; i < parked_cnt; i++)
+            parked.emplace_back(co::CoAttr{.stack_size = stack_size}, [&gate] () { gate.park(); });
+        gate.wait_parked(parked_cnt);
+
+        auto [vm_end, rss_end] = statm_bytes();
+        gate.release(parked_cnt);
+        for (auto & co : parked)
+            co.await();
+        parked.clear();
+        prev_size = stack_size;
+
+        auto vm_delta = vm_end - vm_begin;
+        std::cout << "stack size hint = " << stack_size << ", " << parked_cnt << " parked coroutine, vm = "
+                  << (vm_delta >> 20) << "MB (" << (vm_delta / parked_cnt >> 10) << "KB per coroutine), rss = "
+                  << ((rss_end - rss_begin) >> 20) << "MB" << std::endl;
+#ifdef __STACK_DYN__
+        /* at least the class, at most the class with its reserve and guard */
+        auto class_size = static_cast<int64_t>(stack_size == 0 ? co::MAX_STACK_SIZE : stack_size);
+        assert(vm_delta + block_slack >= parked_cnt * class_size && "stack below its class");
+        assert(vm_delta <= parked_cnt * (class_size + 96 * 1024) + block_slack && "stack above its class");
+#endif
+    }
+
+    end_of_test();
+}
+
+static uint64_t static_stack_walk(uint64_t seed, int depth)
+{
+    volatile uint64_t frame[256];
+    for (int i = 0; i < 256; i++)
+        frame[i] = seed * 31 + i;
+    co::yield();
+
+    uint64_t sum = depth > 0 ? static_stack_walk(seed + 1, depth - 1) : 0;
+    for (int i = 0; i < 256; i++)
+        sum += frame[i];
+
+    return sum;
+}
+
+void static_stack_test()
+{
+    constexpr auto co_cnt = 2000;
+    constexpr auto depth = 8;
+    std::cout << "coroutine static stack test" << std::endl;
+
+    /* frames of coroutines sharing a stack survive the switches in between */
+    std::vector<uint64_t> expect(co_cnt);
+    for (int i = 0; i < co_cnt; i++)
+    {
+        uint64_t sum = 0;
+        for (int d = 0; d <= depth; d++)
+            for (int j = 0; j < 256; j++)
+                sum += (i + d) * 31 + j;
+        expect[i] = sum;
+    }
+
+    std::vector<co::Co<uint64_t>> walkers{};
+    walkers.reserve(co_cnt);
+    for (int i = 0; i < co_cnt; i++)
+        walkers.emplace_back(static_stack_walk, i, depth);
+    for (int i = 0; i < co_cnt; i++)
+        assert(walkers[i].await() == expect[i] && "stack corrupted");
+
+    /* parked coroutines only keep the frames in use */
+    /* a coroutine not started yet can be stolen, one started is pinned to the worker of its stack */
+    constexpr auto parked_cnt = co_cnt * 10;
+    park_gate gate{};
+    std::vector<co::Co<std::thread::id>> parked{};
+    parked.reserve(parked_cnt);
+    auto [vm_begin, rss_begin] = statm_bytes();
+    for (int i = 0; i < parked_cnt; i++)
+    {
+        parked.emplace_back([&gate] ()
+        {
+            auto started_on = std::this_thread::get_id();
+            gate.park();
+#ifdef __STACK_STATIC__
+            assert(std::this_thread::get_id() == started_on && "started coroutine migrated");
+#endif
+            return started_on;
+        });
+    }
+    gate.wait_parked(parked_cnt);
+
+    auto [vm_end, rss_end] = statm_bytes();
+    gate.release(parked_cnt);
+    std::vector<std::thread::id> started_on{};
+    for (auto & co : parked)
+        started_on.push_back(co.await());
+    std::sort(started_on.begin(), started_on.end());
+    auto thread_cnt = std::unique(started_on.begin(), started_on.end()) - started_on.begin();
+
+    auto vm_per_co = (vm_end - vm_begin) / parked_cnt;
+    auto rss_per_co = (rss_end - rss_begin) / parked_cnt;
+    std::cout << parked_cnt << " parked coroutine, vm = " << ((vm_end - vm_begin) >> 20)
+              << "MB, rss = " << ((rss_end - rss_begin) >> 20) << "MB, per coroutine vm = " << vm_per_co
+              << ", rss = " << rss_per_co << ", started on " << thread_cnt << " worker" << std::endl;
+#ifdef __STACK_STATIC__
+    /* a saver buffer of the used frames, less than a page, no stack per coroutine */
+    assert(vm_per_co < 4096 && rss_per_co < 4096 && "parked coroutine holds a stack");
+    if (co::worker_count() > 1)
+        assert(thread_cnt > 1 && "no coroutine stolen before its start");
+#endif
+    end_of_test();
+}
+
+void stack_reclaim_test()
+{
+    constexpr auto parked_cnt = 1000;
+    constexpr auto deep_frame = 128 * 1024;
+    constexpr auto page_size = 4096;
+    std::cout << "coroutine stack reclaim test" << std::endl;
+
+    /* every coroutine dirties a deep frame once, then waits with a small one */
+    park_gate gate{};
+    std::vector<co::Co<int>> parked{};
+    parked.reserve(parked_cnt);
+    auto park_deep = [&gate, &parked] ()
+    {
+        parked.clear();
+        for (int i = 0; i < parked_cnt; i++)
+        {
+            parked.emplace_back([&gate] (int x)
+            {
+                int touched = [] ()
+                {
+                    volatile char frame[deep_frame];
+                    for (std::size_t j = 0; j < deep_frame; j += page_size)
+                        frame[j] = 1;
+                    return frame[0];
+                }();
+
+                volatile int local = x * 3 + touched - 1;
+                gate.park();
+                return local;
+            }, i);
+        }
+        gate.wait_parked(parked_cnt);
+    };
+    auto release_all = [&gate, &parked] ()
+    {
+        gate.release(parked_cnt);
+        for (int i = 0; i < parked_cnt; i++)
+            assert(parked[i].await() == i * 3 && "stack corrupted");
+    };
+
+    auto rss_begin = rss_bytes();
+    park_deep();
+    auto rss_parked = rss_bytes() - rss_begin;
+    auto reclaimed = co::reclaim_stacks();
+    auto rss_reclaimed = rss_bytes() - rss_begin;
+    release_all();
+    std::cout << parked_cnt << " parked coroutine, rss = " << (rss_parked >> 20) << "MB, reclaimed = "
+              << (reclaimed >> 20) << "MB, rss after reclaim = " << (rss_reclaimed >> 20) << "MB" << std::endl;
+#ifdef __STACK_DYN_RECLAIM__
+    /* all but the page holding sp of every deep frame goes back */
+    assert(reclaimed >= static_cast<uint64_t>(parked_cnt) * (deep_frame - page_size) && "stack pages not reclaimed");
+    assert(rss_reclaimed < rss_parked && "rss not dropped by reclaim");
+#endif
+
+#ifdef __STACK_DYN_RECLAIM__
+    /* the tick pass, main inits with a short stack_reclaim_ms for it */
+    auto reclaim_ms = co::co_ctx::options.stack_reclaim_ms == 0 ? co::DEFAULT_STACK_RECLAIM_MS : co::co_ctx::options.stack_reclaim_ms;
+    if (reclaim_ms <= 1000)
+    {
+        auto before = co::stack_reclaim_stats();
+        park_deep();
+        /* the first pass may come right after the parking, a coroutine waits one more interval */
+        co::sleep(std::chrono::milliseconds(reclaim_ms * 2 + 50));
+        auto after = co::stack_reclaim_stats();
+        release_all();
+        std::cout << "tick passes = " << (after.passes - before.passes) << ", reclaimed = "
+                  << ((after.reclaimed_bytes - before.reclaimed_bytes) >> 20) << "MB" << std::endl;
+        assert(after.passes > before.passes && "no reclaim tick");
+        assert(after.reclaimed_bytes - before.reclaimed_bytes >= static_cast<uint64_t>(parked_cnt) * (deep_frame - page_size) && "tick reclaimed nothing");
+    }
+    else
+        std::cout << "tick pass not covered, stack_reclaim_ms = " << reclaim_ms << std::endl;
+#endif
+    end_of_test();
+}
+
+void stack_cache_test()
+{
+    constexpr auto wave_cnt = 50;
+    constexpr auto wave_size = 2000;
+    std::cout << "coroutine stack cache test" << std::endl;
+
+    std::vector<int> input(wave_size);
+    for (int i = 0; i < wave_size; i++)
+        input[i] = i;
+
+    /* every coroutine awaits a child, stacks die on any worker and go back to their own pool */
+    auto run_wave = [&input] ()
+    {
+        auto res = co::spawn_batch(input, [] (int x) -> int64_t
+        {
+            return co::Co<int64_t>{[] (int y) -> int64_t { return y * 2; }, x}.await();
+        }).await_all();
+
+        int64_t sum{};
+        for (auto x : res)
+            sum += x;
+        assert(sum == (int64_t) wave_size * (wave_size - 1) && "wrong wave result");
+    };
+
+    run_wave();
+    auto rss_begin = rss_bytes();
+    start_cal();
+    for (int i = 1; i < wave_cnt; i++)
+        run_wave();
+    end_cal();
+    auto rss_end = rss_bytes();
+
+    /* a worker drains its remote frees before it sleeps */
+    auto stats = co::stack_cache_stats();
+    for (int i = 0; i < 100 && stats.drained != stats.remote_frees; i++)
+    {
+        co::sleep(std::chrono::milliseconds(10));
+        stats = co::stack_cache_stats();
+    }
+
+    std::cout << wave_cnt << " wave of " << wave_size << " coroutine, rss growth after the first wave = "
+              << ((rss_end - rss_begin) >> 20) << "MB" << std::endl;
+    std::cout << "hot hits = " << stats.hot_hits << ", remote frees = " << stats.remote_frees
+              << ", drained = " << stats.drained << std::endl;
+#if defined(__STACK_DYN__) && !defined(__MEM_PMR__)
+    assert(stats.hot_hits > 0 && "no stack from the hot stacks");
+    if (co::worker_count() > 1)
+        assert(stats.remote_frees > 0 && "no stack freed by another worker");
+    assert(stats.drained == stats.remote_frees && "remote frees left undrained");
+#endif
+    end_of_test();
+}
+
+void exit_test()
+{
+    std::cout << "coroutine exit test" << std::endl;
+
+#ifndef __SINGLE_THREAD__
+    /* tick, epoller and worker threads do not survive a fork, a lock they hold would hang the child */
+    std::cout << "skipped, needs __SINGLE_THREAD__" << std::endl;
+#else
+    /* a forked child keeps only this thread, the only worker of __SINGLE_THREAD__ */
+    /* the epoller and clock calibrate threads hold no lock while they wait, no fd is watched here */
+    /* the child exits normally, its thread local runtime is torn down in exit */
+    auto pid = fork();
+    assert(pid >= 0 && "fork failed");
+    if (pid == 0)
+    {
+        int ans = fib_await(20);
+        std::exit(ans == 6765 ? 0 : 1);
+    }
+
+    int status{};
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0 && "runtime teardown failed");
+    std::cout << "child exit status = " << status << std::endl;
+#endif
+
+    end_of_test();
+}
+
 void test()
 {
     std::cout << benchmark(fib_await, 30) << std::endl;
@@ -436,4 +1391,21 @@ void test()
     //channel_test();
     //sleep_test();
     //channel_timed_test();
+    //spawn_batch_test();
+    //ping_pong_test();
+    //maybe_yield_test();
+    //preempt_test();
+    //spawn_blocking_test();
+    //sched_group_test();
+    //deadline_test();
+    //vruntime_skew_test();
+    //wake_affine_test();
+    //wake_batch_test();
+    //stack_rss_test();
+    //stack_overflow_test();
+    //stack_class_test();
+    //static_stack_test();
+    //stack_reclaim_test();
+    //stack_cache_test();
+    //exit_test();
 }
\ No newline at end of file
@@ -2,11 +2,15 @@
 
 #include "../include/CoCtx.h"
 #include "./include/Timer.h"
+#include "../sched/include/WakeBatch.h"
+#ifdef __SCHED_PREEMPT__
+#include "../sched/include/Scheduler.h"
+#endif
 
 namespace co {
     void Timer::push_to_timers(const TimerTaskPtr & task, bool enable_lock)
     {
-        std::unique_lock<spin_lock_sleep> lock;
+        std::unique_lock<decltype(m_lock)> lock;
         if (enable_lock)
             lock = std::unique_lock(m_lock);
 
@@ -46,6 +50,8 @@ namespace co {
         std::vector<TimerTaskPtr> expired = pick_all_expired(end_point);
         lock.unlock();
 
+        /* coroutines woken by callbacks are applied per scheduler at the end */
+        WakeBatch batch{};
         for (auto & task : expired)
         {
             task->callback(true);
@@ -56,6 +62,15 @@ namespace co {
     void Timer::tick()
     {
         process_expired();
+#ifdef __STACK_DYN_RECLAIM__
+        /* tick thread shares local_t with its worker, the stacks of its pool */
+        co_ctx::loc->alloc.dyn_stk_pool.reclaim_tick();
+#endif
+#ifdef __SCHED_PREEMPT__
+        /* tick thread shares local_t with its worker */
+        if (LIKELY(co_ctx::loc->scheduler != nullptr))
+            co_ctx::loc->scheduler->check_preempt();
+#endif
     }
 
     TimerTaskPtr Timer::create_task(const std::function<void(bool)> &callback)
@@ -8,6 +8,7 @@
 #include "../../allocator/include/MemPoolAllocator.h"
 #include "../../utils/include/spin_lock.h"
 #include "../../utils/include/spin_lock_sleep.h"
+#include "../../utils/include/single_thread.h"
 #include "../../data_structure/include/QuaternaryHeap.h"
 
 namespace co {
@@ -25,7 +26,7 @@ namespace co {
         microseconds m_duration{};
         std::function<void(bool)> callback{};
         Timer * timer{};
-        spin_lock is_handling{};
+        worker_lock_t<spin_lock> is_handling{};
 #ifdef __DEBUG_SEM_TRACE__
         std::string sem_wakeup_reason{};
         bool sem_is_timeout{};
@@ -101,7 +102,7 @@ namespace co {
         constexpr static microseconds InvalidTime = microseconds(0);
         constexpr static microseconds TickInterval = microseconds(1500);
 
-        spin_lock_sleep m_lock{};
+        worker_lock_t<spin_lock_sleep> m_lock{};
         std::multiset<TimerTaskPtr, TimerTask::Comparator> m_task{};
 
         std::vector<TimerTaskPtr> pick_all_expired(microseconds end_point);
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "utils.h"
+
+namespace co {
+    /* "0-3,8,10-11" => {0, 1, 2, 3, 8, 10, 11} */
+    inline std::vector<int> parse_cpu_list(const std::string & str)
+    {
+        std::vector<int> ans{};
+        size_t pos = 0;
+        while (pos < str.size())
+        {
+            auto end = str.find(',', pos);
+            if (end == std::string::npos)
+                end = str.size();
+
+            auto item = str.substr(pos, end - pos);
+            pos = end + 1;
+            if (item.empty() || item == "\n")
+                continue;
+
+            auto dash = item.find('-');
+            int first = std::stoi(item.substr(0, dash));
+            int last = dash == std::string::npos ? first : std::stoi(item.substr(dash + 1));
+            for (int i = first; i <= last; i++)
+                ans.push_back(i);
+        }
+
+        return ans;
+    }
+
+    struct NumaTopology
+    {
+        constexpr static auto DEFAULT_PATH = "/sys/devices/system/node";
+
+        /* cpu => node, -1 if unknown */
+        std::vector<int> cpu_node{};
+        int node_count{1};
+
+        /* read <path>/node<N>/cpulist, a fake tree can be used for test */
+        static NumaTopology load(const std::string & path = DEFAULT_PATH)
+        {
+            namespace fs = std::filesystem;
+
+            NumaTopology ans{};
+            std::error_code err{};
+            if (!fs::is_directory(path, err))
+                return ans;
+
+            int max_node = -1;
+            for (auto & entry : fs::directory_iterator(path, err))
+            {
+                auto name = entry.path().filename().string();
+                if (name.size() <= 4 || name.compare(0, 4, "node") != 0
+                    || name.find_first_not_of("0123456789", 4) != std::string::npos)
+                    continue;
+
+                int node = std::stoi(name.substr(4));
+                std::ifstream in(entry.path() / "cpulist");
+                std::string cpu_list{};
+                if (!in || !std::getline(in, cpu_list))
+                    continue;
+
+                for (auto cpu : parse_cpu_list(cpu_list))
+                {
+                    if ((int) ans.cpu_node.size() <= cpu)
+                        ans.cpu_node.resize(cpu + 1, -1);
+                    ans.cpu_node[cpu] = node;
+                }
+                max_node = std::max(max_node, node);
+            }
+
+            ans.node_count = std::max(max_node + 1, 1);
+            return ans;
+        }
+
+        [[nodiscard]] int node_of_cpu(int cpu) const
+        {
+            if (cpu < 0 || cpu >= (int) cpu_node.size() || cpu_node[cpu] < 0)
+                return 0;
+
+            return cpu_node[cpu];
+        }
+    };
+
+    /* prefer the pages of [addr, addr + len) on node, move the touched pages */
+    inline long numa_bind(void * addr, std::size_t len, int node)
+    {
+        if (node < 0 || node >= (int) (sizeof(unsigned long) * 8))
+            return -1;
+
+        auto page_size = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+        auto begin = (reinterpret_cast<std::size_t>(addr) + page_size - 1) & ~(page_size - 1);
+        auto end = (reinterpret_cast<std::size_t>(addr) + len) & ~(page_size - 1);
+        if (begin >= end)
+            return 0;
+
+        unsigned long node_mask = 1UL << node;
+        return syscall(
+                SYS_mbind,
+                begin,
+                end - begin,
+                MPOL_PREFERRED,
+                &node_mask,
+                sizeof(node_mask) * 8,
+                MPOL_MF_MOVE
+        );
+    }
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+
+namespace co {
+#ifdef __SCHED_PREEMPT__
+    /* > 0: async preemption of the running coroutine is deferred */
+    /* reset to 0 when a coroutine is switched in, a region must not span a switch */
+    inline thread_local int preempt_off{};
+
+    inline void preempt_disable()
+    {
+        preempt_off++;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+    }
+
+    inline void preempt_enable()
+    {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        preempt_off--;
+    }
+
+    inline void preempt_reset()
+    {
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        preempt_off = 0;
+    }
+#else
+    inline void preempt_disable() {}
+
+    inline void preempt_enable() {}
+
+    inline void preempt_reset() {}
+#endif
+
+    /* non preemptible region */
+    class PreemptGuard
+    {
+    public:
+        PreemptGuard() { preempt_disable(); }
+        PreemptGuard(const PreemptGuard &) = delete;
+        ~PreemptGuard() { preempt_enable(); }
+    };
+}
@@ -11,7 +11,15 @@
 #include <cstdint>
 #include <exception>
 #include <cerrno>
+#include <climits>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
 #include <semaphore.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
 
 #include "utils.h"
 
@@ -97,4 +105,175 @@ namespace co {
         else
             throw CountingSemModifyException((err = errno));
     }
+
+    inline long futex_wait(std::atomic<uint32_t> * addr, uint32_t expected) {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+    }
+
+    inline long futex_wait_for(std::atomic<uint32_t> * addr, uint32_t expected, std::chrono::nanoseconds timeout) {
+        struct timespec ts{};
+        ts.tv_sec = static_cast<time_t>(timeout.count() / 1000000000);
+        ts.tv_nsec = static_cast<long>(timeout.count() % 1000000000);
+        return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+    }
+
+    inline long futex_wake(std::atomic<uint32_t> * addr, int count) {
+        return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+    }
+
+    /* counting semaphore, spin then park on futex */
+    /* signal(count) is one syscall at most, and none if no one parked */
+    class futex_semaphore {
+    private:
+        constexpr static int32_t MAX_SPIN = 64;
+
+        alignas(__CACHE_LINE__) std::atomic<int64_t> m_count{};
+        std::atomic<uint32_t> m_waiter{};
+        std::atomic<uint32_t> m_seq{};
+    public:
+        explicit inline futex_semaphore(uint32_t count = 0) : m_count(count) {}
+
+        futex_semaphore(const futex_semaphore &) = delete;
+
+        inline void wait();
+
+        inline void signal();
+
+        inline void signal(uint32_t count);
+
+        inline bool try_wait();
+
+        inline int count();
+
+        [[nodiscard]] inline bool has_waiter() const;
+    };
+
+    inline bool futex_semaphore::try_wait() {
+        auto cur = m_count.load(std::memory_order_relaxed);
+        while (cur > 0) {
+            if (m_count.compare_exchange_weak(cur, cur - 1, std::memory_order_acquire, std::memory_order_relaxed))
+                return true;
+        }
+
+        return false;
+    }
+
+    inline void futex_semaphore::wait() {
+        if (spin_wait(MAX_SPIN, [this]() -> bool { return try_wait(); }) != -1)
+            return;
+
+        while (true) {
+            auto seq = m_seq.load(std::memory_order_acquire);
+            /* publish waiter before the last check, pair with signal */
+            m_waiter.fetch_add(1, std::memory_order_seq_cst);
+            if (try_wait()) {
+                m_waiter.fetch_sub(1, std::memory_order_relaxed);
+                return;
+            }
+
+            long res = futex_wait(&m_seq, seq);
+            m_waiter.fetch_sub(1, std::memory_order_relaxed);
+            if (UNLIKELY(res != 0 && errno != EAGAIN && errno != EINTR))
+                throw CountingSemModifyException(errno);
+
+            if (try_wait())
+                return;
+        }
+    }
+
+    inline void futex_semaphore::signal() { signal(1); }
+
+    inline void futex_semaphore::signal(uint32_t count) {
+        if (UNLIKELY(count == 0))
+            return;
+
+        m_count.fetch_add(count, std::memory_order_seq_cst);
+        /* fast path, no one parked */
+        if (m_waiter.load(std::memory_order_seq_cst) == 0)
+            return;
+
+        m_seq.fetch_add(1, std::memory_order_release);
+        futex_wake(&m_seq, static_cast<int>(std::min<uint32_t>(count, INT_MAX)));
+    }
+
+    inline int futex_semaphore::count() {
+        return static_cast<int>(m_count.load(std::memory_order_relaxed));
+    }
+
+    inline bool futex_semaphore::has_waiter() const {
+        return m_waiter.load(std::memory_order_relaxed) > 0;
+    }
+
+#ifdef __SINGLE_THREAD__
+    /* ready tokens of a scheduler with __SINGLE_THREAD__, only the owner signals and waits on the plain count */
+    /* other threads (epoller, spawn_blocking) signal_remote after pushing to the inbox, the owner parks on m_remote */
+    class worker_semaphore {
+    private:
+        int64_t m_count{};
+        alignas(__CACHE_LINE__) std::atomic<uint32_t> m_remote{};
+        std::atomic<uint32_t> m_waiter{};
+    public:
+        worker_semaphore() = default;
+
+        worker_semaphore(const worker_semaphore &) = delete;
+
+        inline void signal() { m_count++; }
+
+        inline void signal(uint32_t count) { m_count += count; }
+
+        inline void signal_remote();
+
+        inline bool try_wait();
+
+        inline void wait();
+
+        inline bool wait_for(std::chrono::nanoseconds timeout);
+
+        inline int count() { return static_cast<int>(m_count + m_remote.load(std::memory_order_relaxed)); }
+
+        [[nodiscard]] inline bool has_waiter() const { return m_waiter.load(std::memory_order_relaxed) > 0; }
+    };
+
+    inline void worker_semaphore::signal_remote() {
+        m_remote.fetch_add(1, std::memory_order_seq_cst);
+        if (m_waiter.load(std::memory_order_seq_cst) == 0)
+            return;
+
+        futex_wake(&m_remote, 1);
+    }
+
+    inline bool worker_semaphore::try_wait() {
+        if (LIKELY(m_count > 0)) {
+            m_count--;
+            return true;
+        }
+
+        if (m_remote.load(std::memory_order_relaxed) == 0)
+            return false;
+
+        m_count += m_remote.exchange(0, std::memory_order_acquire) - 1;
+        return true;
+    }
+
+    inline void worker_semaphore::wait() {
+        while (!wait_for(std::chrono::seconds(1)));
+    }
+
+    /* false on timeout */
+    inline bool worker_semaphore::wait_for(std::chrono::nanoseconds timeout) {
+        if (try_wait())
+            return true;
+
+        /* publish waiter before the last check, pair with signal_remote */
+        m_waiter.store(1, std::memory_order_seq_cst);
+        if (m_remote.load(std::memory_order_seq_cst) == 0) {
+            long res = futex_wait_for(&m_remote, 0, timeout);
+            if (UNLIKELY(res != 0 && errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT))
+                throw CountingSemModifyException(errno);
+        }
+        m_waiter.store(0, std::memory_order_relaxed);
+
+        return try_wait();
+    }
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <type_traits>
+#include <utility>
+
+#include "utils.h"
+
+namespace co {
+    /* __SINGLE_THREAD__, data owned by the only worker, only the owner touches it */
+    /* epoller and blocking pool threads still wake coroutines, SchedManager routes them to the inbox (APPLY_LAZY) */
+    class null_lock
+    {
+    public:
+        void lock() noexcept {}
+
+        bool try_lock() noexcept { return true; }
+
+        void unlock() noexcept {}
+
+        bool try_lock_for(int32_t) noexcept { return true; }
+
+        bool try_lock_for_backoff(uint8_t = 0) noexcept { return true; }
+
+        bool lockable() noexcept { return true; }
+
+        void wait_until_lockable() noexcept {}
+    };
+
+    /* std::atomic interface on a plain value, memory order is ignored */
+    template<typename T>
+    class plain_atomic
+    {
+    private:
+        T m_value{};
+    public:
+        plain_atomic() = default;
+        plain_atomic(T value) : m_value(value) {}
+        plain_atomic(const plain_atomic &) = delete;
+
+        T load(std::memory_order = std::memory_order_seq_cst) const noexcept { return m_value; }
+
+        void store(T value, std::memory_order = std::memory_order_seq_cst) noexcept { m_value = value; }
+
+        T exchange(T value, std::memory_order = std::memory_order_seq_cst) noexcept { return std::exchange(m_value, value); }
+
+        bool compare_exchange_weak(T & expected, T desired,
+                                   std::memory_order = std::memory_order_seq_cst,
+                                   std::memory_order = std::memory_order_seq_cst) noexcept
+        {
+            if (m_value != expected)
+            {
+                expected = m_value;
+                return false;
+            }
+
+            m_value = desired;
+            return true;
+        }
+
+        bool compare_exchange_strong(T & expected, T desired,
+                                     std::memory_order order = std::memory_order_seq_cst,
+                                     std::memory_order fail_order = std::memory_order_seq_cst) noexcept
+        {
+            return compare_exchange_weak(expected, desired, order, fail_order);
+        }
+
+        T fetch_add(T value, std::memory_order = std::memory_order_seq_cst) noexcept
+        {
+            auto ans = m_value;
+            m_value += value;
+            return ans;
+        }
+
+        T fetch_sub(T value, std::memory_order = std::memory_order_seq_cst) noexcept
+        {
+            auto ans = m_value;
+            m_value -= value;
+            return ans;
+        }
+
+        operator T() const noexcept { return m_value; }
+
+        T operator = (T value) noexcept { return m_value = value; }
+
+        T operator ++ (int) noexcept { return m_value++; }
+
+        T operator -- (int) noexcept { return m_value--; }
+
+        T operator ++ () noexcept { return ++m_value; }
+
+        T operator -- () noexcept { return --m_value; }
+    };
+
+    template<typename T, typename Fn>
+    T atomic_fetch_modify(plain_atomic<T> & atomic, Fn && fn, std::memory_order = std::memory_order_seq_cst)
+    {
+        static_assert(std::is_invocable_r_v<T, Fn, T>);
+
+        T cur = atomic.load();
+        atomic.store(fn(cur));
+        return cur;
+    }
+
+#ifdef __SINGLE_THREAD__
+    constexpr static bool single_thread = true;
+#else
+    constexpr static bool single_thread = false;
+#endif
+
+    /* locks and atomics of the worker owned data, plain with __SINGLE_THREAD__ */
+    template<typename Lock>
+    using worker_lock_t = std::conditional_t<single_thread, null_lock, Lock>;
+
+    template<typename T>
+    using worker_atomic_t = std::conditional_t<single_thread, plain_atomic<T>, std::atomic<T>>;
+}
@@ -7,12 +7,15 @@
 
 #include <atomic>
 
+#include "preempt.h"
+
 namespace co {
     class spin_lock {
     private:
         bool m_lock{false};
     public:
         void lock() noexcept {
+            preempt_disable();
             auto lock = reinterpret_cast<std::atomic<bool> *>(&m_lock);
             for (;;) {
                 // Optimistically assume the removal_lock is free on the first try
@@ -29,6 +32,7 @@ namespace co {
         }
 
         bool try_lock_for(int32_t max_spin) {
+            preempt_disable();
             auto lock = reinterpret_cast<std::atomic<bool> *>(&m_lock);
             while (max_spin > 0) {
                 // Optimistically assume the removal_lock is free on the first try
@@ -40,20 +44,27 @@ namespace co {
                     max_spin--;
             }
 
+            preempt_enable();
             return false;
         }
 
         bool try_lock() noexcept {
+            preempt_disable();
             auto lock = reinterpret_cast<std::atomic<bool> *>(&m_lock);
             // First do a relaxed load to check if removal_lock is free in order to prevent
             // unnecessary cache misses if someone does while(!try_lock())
-            return !lock->load(std::memory_order_relaxed) &&
-                   !lock->exchange(true, std::memory_order_acquire);
+            if (!lock->load(std::memory_order_relaxed) &&
+                !lock->exchange(true, std::memory_order_acquire))
+                return true;
+
+            preempt_enable();
+            return false;
         }
 
         void unlock() noexcept {
             auto lock = reinterpret_cast<std::atomic<bool> *>(&m_lock);
             lock->store(false, std::memory_order_release);
+            preempt_enable();
         }
 
         bool lockable() noexcept {
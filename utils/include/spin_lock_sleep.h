@@ -14,6 +14,7 @@
 #include <thread>
 
 #include "atomic_utils.h"
+#include "preempt.h"
 
 namespace co {
 
@@ -36,6 +37,7 @@ namespace co {
 
         int get_backoff() {
             backoff_count = std::min(backoff_count + 1, (int) max_backoff);
+            PreemptGuard guard{};
             return 1 << (co_ctx::loc->rand() % backoff_count);
         }
 
@@ -81,6 +83,7 @@ namespace co {
 
         void lock() noexcept
         {
+            preempt_disable();
             auto lock = atomization(m_lock);
             SpinSleeper sleeper{};
             for (;;) {
@@ -95,19 +98,26 @@ namespace co {
         }
 
         bool try_lock() noexcept {
+            preempt_disable();
             auto lock = atomization(m_lock);
             // First do a relaxed load to check if lock is free in order to prevent
             // unnecessary cache misses if someone does while(!try_lock())
-            return !lock->load(std::memory_order_relaxed) &&
-                   !lock->exchange(true, std::memory_order_acquire);
+            if (!lock->load(std::memory_order_relaxed) &&
+                !lock->exchange(true, std::memory_order_acquire))
+                return true;
+
+            preempt_enable();
+            return false;
         }
 
         void unlock() noexcept {
             auto lock = atomization(m_lock);
             lock->store(false, std::memory_order_release);
+            preempt_enable();
         }
 
         bool try_lock_for(int32_t max_spin) {
+            preempt_disable();
             auto lock = atomization(m_lock);
             SpinSleeper sleeper{};
             while (max_spin > 0) {
@@ -120,10 +130,12 @@ namespace co {
                     max_spin -= sleeper.wait_for(max_spin);
             }
 
+            preempt_enable();
             return false;
         }
 
         bool try_lock_for_backoff(uint8_t max_backoff = SpinSleeper::MaxBackOff) {
+            preempt_disable();
             auto lock = atomization(m_lock);
             SpinSleeper sleeper{};
             while (max_backoff > 0) {
@@ -138,6 +150,7 @@ namespace co {
                 }
             }
 
+            preempt_enable();
             return false;
         }
 
@@ -87,7 +87,7 @@ namespace co {
             while (true) {
                 uint32_t before_seq = param_seq_.load(std::memory_order_acquire) & ~1;
                 std::atomic_signal_fence(std::memory_order_acq_rel);
-                int64_t ns = base_ns_ + (int64_t) ((tsc - base_tsc_) * ns_per_tsc_);
+                int64_t ns = base_ns_ + (int64_t) ((int64_t) (tsc - base_tsc_) * ns_per_tsc_);
                 std::atomic_signal_fence(std::memory_order_acq_rel);
                 uint32_t after_seq = param_seq_.load(std::memory_order_acquire);
                 if (before_seq == after_seq)